@@ -0,0 +1,82 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "allocation_counting.hpp"
+
+#include <cstdlib>
+#include <new>
+
+#if defined(__GLIBC__)
+#  include <malloc.h>
+#endif
+
+#include <curlydoc/memory_accounting.hpp>
+
+using namespace curlydoc;
+
+#if defined(__GLIBC__)
+
+namespace {
+// only set before other threads are started, so it is not atomic
+bool counting_enabled = false;
+} // namespace
+
+bool curlydoc::enable_allocation_counting() {
+  counting_enabled = true;
+  return true;
+}
+
+// Size of a memory block is taken from malloc, so that blocks do not need a
+// header, and allocations are not slowed down when counting is off.
+
+void *operator new(size_t size) {
+  void *p = nullptr;
+
+  // as the standard operator new does, let the new handler free some memory
+  // and try again
+  while (!(p = std::malloc(size == 0 ? 1 : size))) {
+    auto handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+
+  if (counting_enabled) {
+    memory_accounting::allocated(malloc_usable_size(p));
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (counting_enabled && p) {
+    memory_accounting::freed(malloc_usable_size(p));
+  }
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+#else
+
+bool curlydoc::enable_allocation_counting() { return false; }
+
+#endif
@@ -0,0 +1,31 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+namespace curlydoc {
+
+// Report allocations made with global operator new and delete to
+// memory_accounting. Must be called before starting other threads.
+// Returns false if counting is not supported on this platform.
+bool enable_allocation_counting();
+
+} // namespace curlydoc
@@ -0,0 +1,157 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "dependencies.hpp"
+
+#include <array>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <curlydoc/include_cache.hpp>
+
+using namespace curlydoc;
+
+namespace {
+uint64_t hash_stream(std::istream &s) {
+  uint64_t hash = initial_contents_hash;
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  std::array<char, 0x10000> buf;
+  while (s) {
+    s.read(buf.data(), buf.size());
+    hash = hash_contents(
+        utki::make_span(reinterpret_cast<const uint8_t *>(buf.data()),
+                        size_t(s.gcount())),
+        hash);
+  }
+
+  return hash;
+}
+} // namespace
+
+std::optional<uint64_t> file_hasher::hash(const std::string &file_name) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto i = this->hashes.find(file_name);
+    if (i != this->hashes.end()) {
+      return i->second;
+    }
+  }
+
+  std::optional<uint64_t> ret;
+
+  std::ifstream s(file_name, std::ios::binary);
+  if (s) {
+    ret = hash_stream(s);
+    if (s.bad()) {
+      ret.reset();
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->hashes[file_name] = ret;
+
+  return ret;
+}
+
+bool dependency_manifest::add(const std::string &file_name,
+                              file_hasher &hasher) {
+  auto h = hasher.hash(file_name);
+  if (!h) {
+    return false;
+  }
+  this->files.emplace_back(file_name, h.value());
+  return true;
+}
+
+void dependency_manifest::add(const std::string &file_name,
+                              uint64_t contents_hash) {
+  this->files.emplace_back(file_name, contents_hash);
+}
+
+std::optional<dependency_manifest>
+dependency_manifest::load(const std::string &file_name) {
+  std::ifstream s(file_name, std::ios::binary);
+  if (!s) {
+    return {};
+  }
+
+  dependency_manifest ret;
+
+  // each line is a hash in hex followed by a space and the file name
+  for (std::string line; std::getline(s, line);) {
+    std::istringstream ls(line);
+
+    uint64_t hash = 0;
+    ls >> std::hex >> hash;
+    if (!ls || ls.get() != ' ') {
+      return {};
+    }
+
+    std::string name;
+    std::getline(ls, name);
+    if (name.empty()) {
+      return {};
+    }
+
+    ret.files.emplace_back(std::move(name), hash);
+  }
+
+  if (ret.files.empty()) {
+    return {};
+  }
+
+  return ret;
+}
+
+void dependency_manifest::save(const std::string &file_name) const {
+  std::ofstream s(file_name, std::ios::binary);
+
+  for (const auto &f : this->files) {
+    s << std::hex << std::setw(sizeof(uint64_t) * 2) << std::setfill('0')
+      << f.second << ' ' << f.first << '\n';
+  }
+
+  if (!s) {
+    throw std::runtime_error(std::string("could not write file: ") +
+                             file_name);
+  }
+}
+
+bool dependency_manifest::is_up_to_date(file_hasher &hasher) const {
+  for (const auto &f : this->files) {
+    if (hasher.hash(f.first) != f.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<std::string> dependency_manifest::list_file_names() const {
+  std::vector<std::string> ret;
+  ret.reserve(this->files.size());
+  for (const auto &f : this->files) {
+    ret.push_back(f.first);
+  }
+  return ret;
+}
@@ -0,0 +1,73 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace curlydoc {
+
+// Computes hashes of file contents.
+// Each file is hashed only once, so that files included by many documents
+// are read only once per run. Thread-safe.
+class file_hasher {
+  std::mutex mutex;
+
+  // nullopt if the file could not be read
+  std::unordered_map<std::string, std::optional<uint64_t>> hashes;
+
+public:
+  // returns nullopt if the file could not be read
+  std::optional<uint64_t> hash(const std::string &file_name);
+};
+
+// List of files a translated document was made from, along with the hashes
+// of their contents. Used to skip translation of the documents whose sources
+// have not changed since the last translation.
+class dependency_manifest {
+  std::vector<std::pair<std::string, uint64_t>> files;
+
+public:
+  // returns false if the file could not be read
+  bool add(const std::string &file_name, file_hasher &hasher);
+
+  // add the file with the hash of the contents it was translated from,
+  // see curlydoc::hash_contents()
+  void add(const std::string &file_name, uint64_t contents_hash);
+
+  // returns nullopt if the manifest file does not exist or is malformed
+  static std::optional<dependency_manifest> load(const std::string &file_name);
+
+  void save(const std::string &file_name) const;
+
+  // check that all the files still have the same contents
+  bool is_up_to_date(file_hasher &hasher) const;
+
+  std::vector<std::string> list_file_names() const;
+};
+
+} // namespace curlydoc
@@ -0,0 +1,159 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "file_watcher.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <filesystem>
+#include <system_error>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace curlydoc;
+
+#if defined(__linux__)
+
+file_watcher::file_watcher() : fd(inotify_init1(IN_CLOEXEC)) {
+  if (this->fd < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "inotify_init1() failed");
+  }
+}
+
+file_watcher::~file_watcher() { ::close(this->fd); }
+
+void file_watcher::add(const std::string &file_name) {
+  auto dir = std::filesystem::weakly_canonical(file_name).parent_path();
+
+  int wd = inotify_add_watch(this->fd, dir.c_str(),
+                             IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+  if (wd < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            std::string("could not watch directory: ") +
+                                dir.string());
+  }
+
+  // adding the same directory again returns the same watch descriptor
+  this->dirs[wd] = dir.string();
+}
+
+void file_watcher::retain(const std::vector<std::string> &file_names) {
+  std::vector<std::string> needed;
+  needed.reserve(file_names.size());
+  for (const auto &f : file_names) {
+    needed.push_back(
+        std::filesystem::weakly_canonical(f).parent_path().string());
+  }
+
+  for (auto i = this->dirs.begin(); i != this->dirs.end();) {
+    if (std::find(needed.begin(), needed.end(), i->second) != needed.end()) {
+      ++i;
+      continue;
+    }
+    inotify_rm_watch(this->fd, i->first);
+    i = this->dirs.erase(i);
+  }
+}
+
+file_watcher::changes file_watcher::wait() {
+  changes ret;
+
+  // wait for the first event without timeout, then collect the events which
+  // follow shortly, e.g. when an editor writes several files at once
+  int timeout = -1;
+  constexpr int burst_timeout_ms = 5;
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  alignas(inotify_event) std::array<char, 0x1000> buf;
+
+  for (;;) {
+    pollfd pfd{this->fd, POLLIN, 0};
+    int res = poll(&pfd, 1, timeout);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "poll() failed");
+    }
+    if (res == 0) {
+      break;
+    }
+
+    auto len = ::read(this->fd, buf.data(), buf.size());
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(),
+                              "reading inotify events failed");
+    }
+
+    for (ssize_t i = 0; i < len;) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      const auto &e = *reinterpret_cast<const inotify_event *>(&buf[i]);
+      i += ssize_t(sizeof(inotify_event) + e.len);
+
+      // not tied to any watch, so check before looking up the directory
+      if (e.mask & IN_Q_OVERFLOW) {
+        ret.lost = true;
+        continue;
+      }
+
+      auto dir = this->dirs.find(e.wd);
+      if (dir == this->dirs.end() || e.len == 0) {
+        continue;
+      }
+
+      auto path = (std::filesystem::path(dir->second) / e.name).string();
+      if (std::find(ret.files.begin(), ret.files.end(), path) ==
+          ret.files.end()) {
+        ret.files.push_back(std::move(path));
+      }
+    }
+
+    timeout = burst_timeout_ms;
+  }
+
+  return ret;
+}
+
+#else
+
+file_watcher::file_watcher() : fd(-1) {
+  throw std::system_error(std::make_error_code(std::errc::not_supported),
+                          "watching files is not supported on this platform");
+}
+
+file_watcher::~file_watcher() = default;
+
+void file_watcher::add(const std::string &file_name) {}
+
+void file_watcher::retain(const std::vector<std::string> &file_names) {}
+
+file_watcher::changes file_watcher::wait() { return {}; }
+
+#endif
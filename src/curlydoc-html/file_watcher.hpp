@@ -0,0 +1,72 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace curlydoc {
+
+// Waits for changes of files.
+// Directories containing the files are watched, so that files saved by
+// editors via writing a new file and renaming it over the old one are
+// noticed as well. Only supported on Linux, where inotify is used.
+class file_watcher {
+  int fd;
+
+  // watch descriptor to canonical path of the watched directory
+  std::unordered_map<int, std::string> dirs;
+
+public:
+  // throws std::system_error if watching is not supported
+  file_watcher();
+
+  file_watcher(const file_watcher &) = delete;
+  file_watcher &operator=(const file_watcher &) = delete;
+
+  file_watcher(file_watcher &&) = delete;
+  file_watcher &operator=(file_watcher &&) = delete;
+
+  ~file_watcher();
+
+  // start watching the file, does nothing if it is already watched
+  void add(const std::string &file_name);
+
+  // stop watching directories which contain none of the given files
+  void retain(const std::vector<std::string> &file_names);
+
+  struct changes {
+    // canonical paths of the changed files
+    std::vector<std::string> files;
+
+    // the event queue has overflowed, so any of the files could have changed
+    bool lost = false;
+  };
+
+  // Block until some of the files in the watched directories change.
+  // Changes following each other within a few milliseconds are reported
+  // together.
+  changes wait();
+};
+
+} // namespace curlydoc
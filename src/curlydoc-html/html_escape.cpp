@@ -0,0 +1,163 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "html_escape.hpp"
+
+#include <utki/debug.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace curlydoc;
+
+namespace {
+bool is_special(char c) noexcept {
+  return c == '&' || c == '<' || c == '>' || c == '"';
+}
+} // namespace
+
+namespace {
+// returns pointer to the first special character or end
+const char *find_special_scalar(const char *begin, const char *end) noexcept {
+  for (; begin != end; ++begin) {
+    if (is_special(*begin)) {
+      break;
+    }
+  }
+  return begin;
+}
+} // namespace
+
+#if defined(__SSE2__)
+namespace {
+const char *find_special_sse2(const char *begin, const char *end) noexcept {
+  constexpr auto block_size = sizeof(__m128i);
+
+  const auto amp = _mm_set1_epi8('&');
+  const auto lt = _mm_set1_epi8('<');
+  const auto gt = _mm_set1_epi8('>');
+  const auto quot = _mm_set1_epi8('"');
+
+  for (; size_t(end - begin) >= block_size; begin += block_size) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+
+    auto m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quot)));
+
+    auto mask = unsigned(_mm_movemask_epi8(m));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+
+  return find_special_scalar(begin, end);
+}
+} // namespace
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+namespace {
+__attribute__((target("avx2"))) const char *
+find_special_avx2(const char *begin, const char *end) noexcept {
+  constexpr auto block_size = sizeof(__m256i);
+
+  const auto amp = _mm256_set1_epi8('&');
+  const auto lt = _mm256_set1_epi8('<');
+  const auto gt = _mm256_set1_epi8('>');
+  const auto quot = _mm256_set1_epi8('"');
+
+  for (; size_t(end - begin) >= block_size; begin += block_size) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+
+    auto m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, lt)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, gt),
+                        _mm256_cmpeq_epi8(v, quot)));
+
+    auto mask = unsigned(_mm256_movemask_epi8(m));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+
+  return find_special_scalar(begin, end);
+}
+} // namespace
+#endif
+
+namespace {
+using find_special_type = const char *(*)(const char *, const char *) noexcept;
+
+find_special_type select_find_special() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2")) {
+    return &find_special_avx2;
+  }
+#endif
+#if defined(__SSE2__)
+  return &find_special_sse2;
+#else
+  return &find_special_scalar;
+#endif
+}
+} // namespace
+
+namespace {
+std::string_view to_reference(char c) noexcept {
+  switch (c) {
+  case '&':
+    return "&amp;";
+  case '<':
+    return "&lt;";
+  case '>':
+    return "&gt;";
+  case '"':
+    return "&quot;";
+  default:
+    ASSERT(false)
+    return {};
+  }
+}
+} // namespace
+
+void curlydoc::write_html_escaped(output_sink &out, std::string_view text) {
+  // CPU features are checked only once
+  static const auto find_special = select_find_special();
+
+  const char *p = text.data();
+  const char *end = p + text.size();
+
+  while (p != end) {
+    const char *s = find_special(p, end);
+    if (s != p) {
+      out.write(std::string_view(p, s - p));
+    }
+    if (s == end) {
+      break;
+    }
+    out.write(to_reference(*s));
+    p = s + 1;
+  }
+}
@@ -0,0 +1,36 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <string_view>
+
+#include <curlydoc/output_sink.hpp>
+
+namespace curlydoc {
+
+// Write text to the sink replacing characters which have special meaning in
+// HTML, i.e. '&', '<', '>' and '"', with character references.
+// The text is scanned for special characters with SIMD instructions when
+// available, runs of ordinary characters are written as is.
+void write_html_escaped(output_sink &out, std::string_view text);
+
+} // namespace curlydoc
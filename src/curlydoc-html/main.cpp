@@ -19,45 +19,69 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 /* ================ LICENSE END ================ */
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include <clargs/parser.hpp>
+#include <curlydoc/binary_forest.hpp>
 #include <curlydoc/interpreter.hpp>
+#include <curlydoc/mapped_file.hpp>
 #include <papki/fs_file.hpp>
+#include <utki/util.hpp>
 #include <utki/string.hpp>
 
+#include "allocation_counting.hpp"
+#include "dependencies.hpp"
+#include "file_watcher.hpp"
 #include "translator_to_html.hpp"
 
 namespace {
-void translate(std::string_view file_name, bool save_evaled) {
-  std::string out_file_name = utki::split(file_name, '.').front() + ".html";
-  std::string evaled_file_name;
-  if (save_evaled) {
-    evaled_file_name = utki::split(file_name, '.').front() + ".cudoc_evaled";
-  }
-
-  curlydoc::interpreter interpreter(
-      std::make_unique<papki::fs_file>(file_name));
-
-  curlydoc::translator_to_html translator;
-
-  interpreter.add_repeater_functions(translator.list_tags());
+struct options {
+  bool save_evaled = false;
+  bool save_evaled_binary = false;
+  bool from_evaled = false;
+  bool memoize = false;
+  bool incremental = false;
+  bool watch = false;
+  bool profile = false;
+  bool memory_stats = false;
+  std::string profile_trace_file_name;
 
-  std::cout << "Hello curlydoc-html!" << '\n';
+  // call depth is limited by default, so that runaway recursion, e.g. a file
+  // including itself, fails instead of overflowing the stack of the thread
+  curlydoc::interpreter::limits limits = {/* max_depth = */ 2000};
 
-  std::cout << "output file name = " << out_file_name << '\n';
+  unsigned num_jobs = std::max(std::thread::hardware_concurrency(), 1U);
+};
+} // namespace
 
-  auto evaled = interpreter.eval();
+namespace {
+// Write HTML document, the body is translated by the given function.
+// The document is written to a temporary file which replaces the output file
+// only on success, so a failed translation does not leave a truncated
+// document behind.
+void write_html(
+    const std::string &file_name,
+    const std::function<void(curlydoc::translator &)> &translate_body) {
+  std::string tmp_file_name = file_name + ".tmp";
 
-  if (save_evaled) {
-    std::ofstream outf(evaled_file_name, std::ios::binary);
+  utki::scope_exit tmp_file_scope_exit([&tmp_file_name]() {
+    std::error_code ec;
+    std::filesystem::remove(tmp_file_name, ec);
+  });
 
-    outf << tml::to_non_ext(evaled);
-  }
+  curlydoc::fd_sink outf(tmp_file_name);
 
-  translator.translate(evaled);
-
-  std::ofstream outf(out_file_name, std::ios::binary);
+  curlydoc::translator_to_html translator(outf);
 
   outf << "<!doctype html>"
           "\n"
@@ -87,34 +111,562 @@ void translate(std::string_view file_name, bool save_evaled) {
           "\n"
           "<body>";
 
-  outf << translator.ss.str();
+  translate_body(translator);
 
   outf << "\n"
           "</body>"
           "\n"
           "</html>"
           "\n";
+
+  outf.flush();
+
+  std::filesystem::rename(tmp_file_name, file_name);
+  tmp_file_scope_exit.release();
+}
+} // namespace
+
+namespace {
+// the hashes are of the contents the document was translated from, so that
+// files changed during translation make the document outdated
+void save_manifest(
+    const std::string &deps_file_name,
+    const std::vector<std::string> &file_names,
+    const std::unordered_map<std::string, uint64_t> &file_hashes) {
+  curlydoc::dependency_manifest deps;
+
+  for (const auto &f : file_names) {
+    auto i = file_hashes.find(f);
+    if (i == file_hashes.end()) {
+      // without the manifest the document is translated again next time
+      return;
+    }
+    deps.add(f, i->second);
+  }
+
+  deps.save(deps_file_name);
+}
+} // namespace
+
+namespace {
+void write_memory_stats(std::ostream &log) {
+  using curlydoc::memory_accounting;
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  constexpr ptrdiff_t kb = 1024;
+
+  const auto &stats = memory_accounting::get();
+
+  log << "memory: peak = " << stats.peak_bytes / kb << " kB" << '\n';
+
+  for (size_t i = 0; i != stats.phases.size(); ++i) {
+    const auto &p = stats.phases[i];
+    if (p.num_allocations == 0) {
+      continue;
+    }
+    log << "memory: "
+        << memory_accounting::to_string(memory_accounting::phase(i))
+        << ": peak = " << p.peak_bytes / kb << " kB"
+        << ", net = " << p.net_bytes / kb << " kB"
+        << ", allocated = " << ptrdiff_t(p.allocated_bytes) / kb << " kB in "
+        << p.num_allocations << " allocations" << '\n';
+  }
+}
+} // namespace
+
+namespace {
+// dependencies are the document file and the files it includes, they are
+// reported even if translation fails
+void translate(const std::string &file_name, const options &opts,
+               const curlydoc::interpreter::snapshot &prelude,
+               curlydoc::file_hasher &hasher, std::ostream &log,
+               std::vector<std::string> &dependencies,
+               std::shared_ptr<curlydoc::profiler> prof) {
+  dependencies = {file_name};
+
+  std::string base_name = utki::split(file_name, '.').front();
+
+  std::string out_file_name = base_name + ".html";
+  std::string evaled_file_name;
+  if (opts.save_evaled) {
+    evaled_file_name = base_name + ".cudoc_evaled";
+  }
+  std::string binary_evaled_file_name;
+  if (opts.save_evaled_binary) {
+    binary_evaled_file_name = base_name + ".cudoc_bin";
+  }
+
+  std::string deps_file_name;
+  if (opts.incremental) {
+    deps_file_name = base_name + ".cudoc_deps";
+
+    auto deps = curlydoc::dependency_manifest::load(deps_file_name);
+    if (deps && std::filesystem::exists(out_file_name) &&
+        (!opts.save_evaled || std::filesystem::exists(evaled_file_name)) &&
+        (!opts.save_evaled_binary ||
+         std::filesystem::exists(binary_evaled_file_name)) &&
+        deps->is_up_to_date(hasher)) {
+      log << "up to date: " << out_file_name << '\n';
+      dependencies = deps->list_file_names();
+      return;
+    }
+
+    // in case translation fails, the outdated manifest must not stay
+    std::filesystem::remove(deps_file_name);
+  }
+
+  if (opts.memory_stats) {
+    curlydoc::memory_accounting::reset();
+  }
+  utki::scope_exit memory_stats_scope_exit([&]() {
+    if (opts.memory_stats) {
+      write_memory_stats(log);
+    }
+  });
+
+  log << "Hello curlydoc-html!" << '\n';
+
+  log << "output file name = " << out_file_name << '\n';
+
+  if (opts.from_evaled) {
+    // the document is already evaluated, only translation is left
+    curlydoc::mapped_file mapped(file_name);
+    curlydoc::binary_forest evaled(mapped.data());
+    uint64_t contents_hash = curlydoc::hash_contents(mapped.data());
+
+    // nodes are read from the mapped file one top-level node at a time
+    write_html(out_file_name, [&](curlydoc::translator &translator) {
+      for (size_t i = 0; i != evaled.size(); i = evaled.next(i)) {
+        translator.translate_next(evaled.to_tree(i));
+      }
+    });
+
+    if (opts.incremental) {
+      save_manifest(deps_file_name, {file_name}, {{file_name, contents_hash}});
+    }
+    return;
+  }
+
+  curlydoc::interpreter interpreter(
+      prelude, std::make_unique<papki::fs_file>(file_name));
+
+  interpreter.set_profiler(std::move(prof));
+  interpreter.set_limits(opts.limits);
+
+  utki::scope_exit dependencies_scope_exit([&]() {
+    const auto &included = interpreter.get_included_file_names();
+    dependencies.insert(dependencies.end(), included.begin(), included.end());
+  });
+
+  bool keep_evaled = opts.save_evaled || opts.save_evaled_binary;
+
+  // evaluated nodes are translated and written out one by one, so the whole
+  // evaluated document is never held in memory, unless it is to be saved
+  tml::forest_ext evaled;
+
+  auto save_evaled = [&]() {
+    if (opts.save_evaled) {
+      std::ofstream outf(evaled_file_name, std::ios::binary);
+
+      outf << tml::to_non_ext(evaled);
+    }
+
+    if (opts.save_evaled_binary) {
+      curlydoc::fd_sink outf(binary_evaled_file_name);
+
+      curlydoc::write_binary(evaled, outf);
+
+      outf.flush();
+    }
+  };
+
+  write_html(out_file_name, [&](curlydoc::translator &translator) {
+    // the evaluated document is saved even if its translation fails,
+    // since that is where the cause of the translation error is looked for
+    std::exception_ptr translation_error;
+
+    interpreter.eval([&](tml::tree_ext &&node) {
+      if (!translation_error) {
+        try {
+          translator.translate_next(node);
+        } catch (std::exception &) {
+          if (!keep_evaled) {
+            throw;
+          }
+          translation_error = std::current_exception();
+        }
+      }
+
+      if (keep_evaled) {
+        evaled.push_back(std::move(node));
+      }
+    });
+
+    if (translation_error) {
+      save_evaled();
+      std::rethrow_exception(translation_error);
+    }
+  });
+
+  save_evaled();
+
+  if (opts.incremental) {
+    std::vector<std::string> file_names = {file_name};
+    const auto &included = interpreter.get_included_file_names();
+    file_names.insert(file_names.end(), included.begin(), included.end());
+
+    save_manifest(deps_file_name, file_names, interpreter.get_file_hashes());
+  }
+}
+} // namespace
+
+namespace {
+struct translation_result {
+  std::stringstream log;
+  std::string error;
+
+  // null if profiling is off
+  std::shared_ptr<curlydoc::profiler> prof;
+};
+} // namespace
+
+namespace {
+// Translate files in parallel and report results in the order of the files.
+// Returns false if translation of any file has failed.
+bool translate_files(const std::vector<std::string> &files,
+                     const options &opts,
+                     const curlydoc::interpreter::snapshot &prelude,
+                     std::vector<std::vector<std::string>> &dependencies) {
+  std::vector<translation_result> results(files.size());
+  dependencies.resize(files.size());
+
+  bool trace = !opts.profile_trace_file_name.empty();
+  if (opts.profile || trace) {
+    for (auto &r : results) {
+      r.prof = std::make_shared<curlydoc::profiler>(trace);
+    }
+  }
+
+  // shared, so that files included by many documents are hashed only once
+  curlydoc::file_hasher hasher;
+
+  // each thread takes the next file once it is done with the previous one,
+  // so threads which get smaller files translate more of them
+  std::atomic<size_t> next_file = 0;
+
+  auto worker = [&]() {
+    for (size_t i = next_file++; i < files.size(); i = next_file++) {
+      auto &r = results[i];
+      try {
+        translate(files[i], opts, prelude, hasher, r.log, dependencies[i],
+                  r.prof);
+      } catch (std::exception &e) {
+        r.error = e.what();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(size_t(opts.num_jobs), files.size()); ++i) {
+    threads.emplace_back(worker);
+  }
+
+  worker();
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  // report in the order of input files, regardless of the order the files
+  // were translated in
+  bool ret = true;
+  for (size_t i = 0; i != files.size(); ++i) {
+    const auto &r = results[i];
+    std::cout << r.log.str();
+    if (!r.error.empty()) {
+      std::cout << "error: " << files[i] << ": " << r.error << '\n';
+      ret = false;
+    }
+  }
+
+  if (opts.profile || trace) {
+    curlydoc::profiler total(trace);
+    for (size_t i = 0; i != files.size(); ++i) {
+      total.merge(*results[i].prof, files[i]);
+    }
+
+    if (opts.profile) {
+      std::cout << "profile:" << '\n';
+      total.write_report(std::cout);
+    }
+
+    if (trace) {
+      std::ofstream f(opts.profile_trace_file_name, std::ios::binary);
+      total.write_trace(f);
+      if (!f) {
+        std::cout << "error: could not write profile trace: "
+                  << opts.profile_trace_file_name << '\n';
+        ret = false;
+      }
+    }
+  }
+
+  return ret;
+}
+} // namespace
+
+namespace {
+// Translate documents again when their files or included files change.
+// The prelude snapshot and the include cache stay warm between the rebuilds.
+[[noreturn]] void watch(const std::vector<std::string> &files,
+                        const options &opts,
+                        const curlydoc::interpreter::snapshot &prelude,
+                        std::vector<std::vector<std::string>> &&dependencies) {
+  curlydoc::file_watcher watcher;
+
+  // canonical paths of the dependencies, to match them against the changed
+  // files reported by the watcher
+  std::vector<std::vector<std::string>> watched(files.size());
+
+  auto update_watches = [&](size_t i) {
+    watched[i].clear();
+    for (const auto &d : dependencies[i]) {
+      try {
+        watcher.add(d);
+      } catch (std::exception &e) {
+        std::cout << "warning: " << e.what() << '\n';
+      }
+      watched[i].push_back(std::filesystem::weakly_canonical(d).string());
+    }
+  };
+
+  // stop watching directories which no document depends on anymore
+  auto remove_unused_watches = [&]() {
+    std::vector<std::string> all;
+    for (const auto &w : watched) {
+      all.insert(all.end(), w.begin(), w.end());
+    }
+    watcher.retain(all);
+  };
+
+  for (size_t i = 0; i != files.size(); ++i) {
+    update_watches(i);
+  }
+
+  std::cout << "watching for changes..." << std::endl;
+
+  for (;;) {
+    auto changed = watcher.wait();
+
+    if (changed.lost) {
+      std::cout << "warning: file change events were lost, "
+                   "rebuilding all documents"
+                << '\n';
+    }
+
+    std::vector<size_t> affected;
+    for (size_t i = 0; i != files.size(); ++i) {
+      if (changed.lost ||
+          std::find_first_of(watched[i].begin(), watched[i].end(),
+                             changed.files.begin(),
+                             changed.files.end()) != watched[i].end()) {
+        affected.push_back(i);
+      }
+    }
+
+    if (affected.empty()) {
+      continue;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::string> affected_files;
+    affected_files.reserve(affected.size());
+    for (auto i : affected) {
+      affected_files.push_back(files[i]);
+    }
+
+    std::vector<std::vector<std::string>> affected_dependencies;
+    translate_files(affected_files, opts, prelude, affected_dependencies);
+
+    for (size_t k = 0; k != affected.size(); ++k) {
+      dependencies[affected[k]] = std::move(affected_dependencies[k]);
+      update_watches(affected[k]);
+    }
+    remove_unused_watches();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    std::cout << "rebuilt " << affected.size() << " document(s) in "
+              << elapsed.count() << " ms" << '\n';
+    std::cout << "watching for changes..." << std::endl;
+  }
+}
+} // namespace
+
+namespace {
+// Parse a number given as a command line option value.
+// Throws std::invalid_argument if the value is not a number or is less than
+// the minimal value.
+template <typename number_type>
+number_type parse_number(std::string_view option, std::string_view value,
+                         number_type min_value = 0) {
+  number_type ret = 0;
+  auto res = std::from_chars(value.data(), value.data() + value.size(), ret);
+  if (res.ec != std::errc() || res.ptr != value.data() + value.size() ||
+      ret < min_value) {
+    std::stringstream ss;
+    ss << "invalid value of --" << option << ": '" << value
+       << "', expected a number not less than " << min_value;
+    throw std::invalid_argument(ss.str());
+  }
+  return ret;
 }
 } // namespace
 
 int main(int argc, const char **argv) {
   clargs::parser cli;
 
-  bool save_evaled = false;
+  options opts;
 
   cli.add("save-evaled", "save interpreter output",
-          [&save_evaled]() { save_evaled = true; });
+          [&opts]() { opts.save_evaled = true; });
+
+  cli.add("save-evaled-binary",
+          "save interpreter output in binary format to .cudoc_bin files, "
+          "which can be translated later with --from-evaled",
+          [&opts]() { opts.save_evaled_binary = true; });
+
+  cli.add("from-evaled",
+          "input files are interpreter output saved with "
+          "--save-evaled-binary, translate them without evaluating",
+          [&opts]() { opts.from_evaled = true; });
+
+  cli.add("memoize", "cache results of repeated macro invocations",
+          [&opts]() { opts.memoize = true; });
+
+  cli.add("incremental",
+          "skip documents whose sources and included files did not change "
+          "since the last run, dependencies are stored in .cudoc_deps files",
+          [&opts]() { opts.incremental = true; });
+
+  cli.add("watch",
+          "stay running and translate documents again when they or the "
+          "files they include change",
+          [&opts]() { opts.watch = true; });
+
+  cli.add("profile",
+          "print number of calls, time and output size of each function, "
+          "macro and included file",
+          [&opts]() { opts.profile = true; });
+
+  cli.add("profile-trace",
+          "write each call of functions, macros and included files to the "
+          "given file in Chrome trace event format",
+          [&opts](std::string_view v) { opts.profile_trace_file_name = v; });
+
+  cli.add("memory-stats",
+          "print memory usage of each document by phase: parse, eval, "
+          "translate and emit, net is memory allocated minus memory freed "
+          "during the phase, including memory allocated by other phases",
+          [&opts]() { opts.memory_stats = true; });
+
+  cli.add("max-depth",
+          "maximum nesting depth of calls of functions evaluating their "
+          "arguments, e.g. include or for, macro calls are not counted, 0 for "
+          "no limit, defaults to " +
+              std::to_string(opts.limits.max_depth),
+          [&opts](std::string_view v) {
+            opts.limits.max_depth = parse_number<size_t>("max-depth", v);
+          });
+
+  cli.add("max-nodes",
+          "maximum number of nodes produced when evaluating a document, 0 "
+          "for no limit, which is the default",
+          [&opts](std::string_view v) {
+            opts.limits.max_nodes = parse_number<size_t>("max-nodes", v);
+          });
 
-  auto positional = cli.parse(argc, argv);
+  cli.add("max-expansions",
+          "maximum number of macro invocations when evaluating a document, "
+          "0 for no limit, which is the default",
+          [&opts](std::string_view v) {
+            opts.limits.max_expansions =
+                parse_number<size_t>("max-expansions", v);
+          });
+
+  cli.add("time-limit",
+          "maximum time in milliseconds of evaluating a document, 0 for no "
+          "limit, which is the default",
+          [&opts](std::string_view v) {
+            opts.limits.max_time = std::chrono::milliseconds(
+                parse_number<std::chrono::milliseconds::rep>("time-limit", v));
+          });
+
+  cli.add("jobs",
+          "number of files to translate in parallel, defaults to number of "
+          "CPU cores",
+          [&opts](std::string_view v) {
+            opts.num_jobs = parse_number<unsigned>("jobs", v, 1);
+          });
+
+  std::vector<std::string> positional;
+  try {
+    positional = cli.parse(argc, argv);
+  } catch (std::invalid_argument &e) {
+    std::cout << "error: " << e.what() << '\n';
+    return 1;
+  }
 
   if (positional.empty()) {
     std::cout << "error: input file is not given" << '\n';
     return 1;
   }
 
-  for (const auto &f : positional) {
-    translate(f, save_evaled);
+  if (opts.memory_stats && !curlydoc::enable_allocation_counting()) {
+    std::cout << "error: --memory-stats is not supported on this platform"
+              << '\n';
+    return 1;
+  }
+
+  if (opts.from_evaled && (opts.save_evaled || opts.save_evaled_binary)) {
+    std::cout << "error: --from-evaled input is already evaluated" << '\n';
+    return 1;
+  }
+
+  // watched files are edited while the tool runs, a mapped file truncated
+  // while it is parsed would crash the process
+  if (opts.watch) {
+    curlydoc::enable_file_mapping(false);
+  }
+
+  // interpreters for all the documents are forked from the same prelude
+  // interpreter, so functions are added only once, and included files are
+  // parsed once for all the documents
+  curlydoc::interpreter prelude(nullptr);
+  {
+    curlydoc::memory_sink no_output;
+    prelude.add_repeater_functions(
+        curlydoc::translator_to_html(no_output).list_tags());
+  }
+  prelude.enable_memoization(opts.memoize);
+  prelude.set_include_cache(std::make_shared<curlydoc::include_cache>());
+
+  auto prelude_snapshot = prelude.make_snapshot();
+
+  std::vector<std::vector<std::string>> dependencies;
+
+  bool ok = translate_files(positional, opts, prelude_snapshot, dependencies);
+
+  if (opts.watch) {
+    try {
+      watch(positional, opts, prelude_snapshot, std::move(dependencies));
+    } catch (std::exception &e) {
+      std::cout << "error: " << e.what() << '\n';
+      return 1;
+    }
   }
 
-  return 0;
+  return ok ? 0 : 1;
 }
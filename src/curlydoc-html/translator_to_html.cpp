@@ -21,6 +21,8 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "translator_to_html.hpp"
 
+#include "html_escape.hpp"
+
 #include <numeric>
 #include <ratio>
 
@@ -33,99 +35,101 @@ void translator_to_html::on_word(const std::string &word) {
       return;
     }
   }
-  this->ss << word;
+  write_html_escaped(this->out, word);
 }
 
 void translator_to_html::on_paragraph(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<p>";
+  this->out << '\n' << "<p>";
   this->translate(forest);
-  this->ss << "</p>";
+  this->out << "</p>";
 }
 
 void translator_to_html::on_bold(const tml::forest_ext &forest) {
-  this->ss << "<b>";
+  this->out << "<b>";
   this->translate(forest);
-  this->ss << "</b>";
+  this->out << "</b>";
 }
 
 void translator_to_html::on_italic(const tml::forest_ext &forest) {
-  this->ss << "<i>";
+  this->out << "<i>";
   this->translate(forest);
-  this->ss << "</i>";
+  this->out << "</i>";
 }
 
 void translator_to_html::on_underline(const tml::forest_ext &forest) {
-  this->ss << "<u>";
+  this->out << "<u>";
   this->translate(forest);
-  this->ss << "</u>";
+  this->out << "</u>";
 }
 
 void translator_to_html::on_strikethrough(const tml::forest_ext &forest) {
-  this->ss << "<s>";
+  this->out << "<s>";
   this->translate(forest);
-  this->ss << "</s>";
+  this->out << "</s>";
 }
 
 void translator_to_html::on_monospace(const tml::forest_ext &forest) {
-  this->ss << "<code>";
+  this->out << "<code>";
   this->translate(forest);
-  this->ss << "</code>";
+  this->out << "</code>";
 }
 
 void translator_to_html::on_header1(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<h1>";
+  this->out << '\n' << "<h1>";
   this->translate(forest);
-  this->ss << "</h1>";
+  this->out << "</h1>";
 }
 
 void translator_to_html::on_header2(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<h2>";
+  this->out << '\n' << "<h2>";
   this->translate(forest);
-  this->ss << "</h2>";
+  this->out << "</h2>";
 }
 
 void translator_to_html::on_header3(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<h3>";
+  this->out << '\n' << "<h3>";
   this->translate(forest);
-  this->ss << "</h3>";
+  this->out << "</h3>";
 }
 
 void translator_to_html::on_header4(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<h4>";
+  this->out << '\n' << "<h4>";
   this->translate(forest);
-  this->ss << "</h4>";
+  this->out << "</h4>";
 }
 
 void translator_to_html::on_header5(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<h5>";
+  this->out << '\n' << "<h5>";
   this->translate(forest);
-  this->ss << "</h5>";
+  this->out << "</h5>";
 }
 
 void translator_to_html::on_header6(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<h6>";
+  this->out << '\n' << "<h6>";
   this->translate(forest);
-  this->ss << "</h6>";
+  this->out << "</h6>";
 }
 
 void translator_to_html::on_ins(const tml::forest_ext &forest) {
-  this->ss << '\n' << "<br/>" << '\n';
+  this->out << '\n' << "<br/>" << '\n';
   this->no_next_space = true;
 }
 
 void translator_to_html::on_image(const image_params &params,
                                   const tml::forest_ext &forest) {
-  this->ss << "<img src=\"" << params.url << "\"";
+  this->out << "<img src=\"";
+  write_html_escaped(this->out, params.url);
+  this->out << "\"";
 
   if (params.width) {
-    this->ss << " width=\"" << params.width.value() << "\"";
+    this->out << " width=\"" << std::to_string(params.width.value()) << "\"";
   }
 
   if (params.height) {
-    this->ss << " height=\"" << params.height.value() << "\"";
+    this->out << " height=\"" << std::to_string(params.height.value()) << "\"";
   }
 
-  this->ss << "/>";
+  this->out << "/>";
 }
 
 namespace {
@@ -162,7 +166,7 @@ std::string to_string(translator::valign a) {
 
 void translator_to_html::on_table(const table &tbl,
                                   const tml::forest_ext &forest) {
-  this->ss << '\n' << "<table width=\"100%\">";
+  this->out << '\n' << "<table width=\"100%\">";
 
   ASSERT(tbl.weights.size() == tbl.num_cols)
   ASSERT(tbl.aligns.size() == tbl.num_cols)
@@ -178,19 +182,21 @@ void translator_to_html::on_table(const table &tbl,
   }
 
   for (const auto &r : tbl.rows) {
-    this->ss << '\n' << "<tr>";
+    this->out << '\n' << "<tr>";
 
     for (const auto &c : r.cells) {
       std::vector<std::string> style;
-      this->ss << '\n' << "<td";
+      this->out << '\n' << "<td";
       if (c.col_span) {
-        this->ss << " colspan=\"" << c.col_span.value() << '\"';
+        this->out << " colspan=\"" << std::to_string(c.col_span.value())
+                  << '\"';
       } else {
         style.push_back(std::string("width:") +
                         std::to_string(weight_percent[c.col_index]) + "%");
       }
       if (c.row_span) {
-        this->ss << " rowspan=\"" << c.row_span.value() << '\"';
+        this->out << " rowspan=\"" << std::to_string(c.row_span.value())
+                  << '\"';
       }
       if (tbl.border) {
         style.push_back(std::string("border-width:") +
@@ -201,32 +207,32 @@ void translator_to_html::on_table(const table &tbl,
       style.push_back(std::string("vertical-align: ") +
                       to_string(tbl.valigns[c.col_index]));
       if (!style.empty()) {
-        this->ss << " style=\"";
+        this->out << " style=\"";
         for (const auto &s : style) {
-          this->ss << s << ";";
+          this->out << s << ";";
         }
-        this->ss << '\"';
+        this->out << '\"';
       }
-      this->ss << '>';
+      this->out << '>';
       this->translate(c.begin, c.end);
-      this->ss << "</td>";
+      this->out << "</td>";
     }
-    this->ss << '\n' << "</tr>";
+    this->out << '\n' << "</tr>";
   }
 
-  this->ss << '\n' << "</table>";
+  this->out << '\n' << "</table>";
 }
 
 void translator_to_html::on_list(const list &l, const tml::forest_ext &forest) {
   const auto tag = l.ordered ? "ol" : "ul";
 
-  this->ss << '\n' << '<' << tag << '>';
+  this->out << '\n' << '<' << tag << '>';
 
   for (const auto &li : l.items) {
-    this->ss << '\n' << "<li>";
-    this->translate(li);
-    this->ss << "</li>";
+    this->out << '\n' << "<li>";
+    this->translate(li.begin, li.end);
+    this->out << "</li>";
   }
 
-  this->ss << '\n' << "</" << tag << '>';
+  this->out << '\n' << "</" << tag << '>';
 }
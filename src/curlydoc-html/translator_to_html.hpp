@@ -21,8 +21,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
-#include <sstream>
-
+#include <curlydoc/output_sink.hpp>
 #include <curlydoc/translator.hpp>
 
 namespace curlydoc {
@@ -30,8 +29,10 @@ namespace curlydoc {
 class translator_to_html : public translator {
   bool no_next_space = false;
 
+  output_sink &out;
+
 public:
-  std::stringstream ss;
+  translator_to_html(output_sink &out) : out(out) {}
 
   void on_word(const std::string &word) override;
   void on_paragraph(const tml::forest_ext &forest) override;
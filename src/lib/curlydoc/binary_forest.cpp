@@ -0,0 +1,257 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "binary_forest.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+using namespace curlydoc;
+
+namespace {
+constexpr std::array<char, 4> magic = {'C', 'D', 'B', 'F'};
+constexpr uint32_t format_version = 1;
+
+constexpr size_t header_size = 5 * sizeof(uint32_t);
+constexpr size_t string_entry_size = 2 * sizeof(uint32_t);
+
+enum node_field {
+  string_index,
+  line,
+  offset,
+  flags,
+  num_descendants,
+
+  enum_size
+};
+
+constexpr size_t node_size = node_field::enum_size * sizeof(uint32_t);
+} // namespace
+
+namespace {
+uint32_t read_u32(const uint8_t *p) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+         (uint32_t(p[3]) << 24);
+}
+
+void append_u32(std::string &buf, size_t value) {
+  if (value > UINT32_MAX) {
+    throw std::length_error("write_binary(): forest is too big");
+  }
+  for (size_t i = 0; i != sizeof(uint32_t); ++i) {
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+    buf.push_back(char((value >> (i * 8)) & 0xff));
+  }
+}
+} // namespace
+
+namespace {
+class binary_writer {
+  std::unordered_map<std::string_view, uint32_t> string_indices;
+
+public:
+  std::string string_table;
+  std::string nodes;
+  std::string string_data;
+
+  size_t num_strings = 0;
+  size_t num_nodes = 0;
+
+  // returns number of written nodes
+  size_t write(const tml::tree_ext &tree) {
+    auto res = this->string_indices.try_emplace(tree.value.to_string(),
+                                                uint32_t(this->num_strings));
+    if (res.second) {
+      append_u32(this->string_table, this->string_data.size());
+      append_u32(this->string_table, tree.value.to_string().size());
+      this->string_data.append(tree.value.to_string());
+      ++this->num_strings;
+    }
+
+    uint32_t flags = 0;
+    for (size_t i = 0; i != size_t(tml::flag::enum_size); ++i) {
+      if (tree.value.info.flags.get(tml::flag(i))) {
+        flags |= 1 << i;
+      }
+    }
+
+    size_t pos = this->nodes.size();
+
+    append_u32(this->nodes, res.first->second);
+    append_u32(this->nodes, tree.value.info.location.line);
+    append_u32(this->nodes, tree.value.info.location.offset);
+    append_u32(this->nodes, flags);
+    append_u32(this->nodes, 0); // number of descendants, set below
+    ++this->num_nodes;
+
+    size_t num_descendants = 0;
+    for (const auto &c : tree.children) {
+      num_descendants += this->write(c);
+    }
+
+    std::string descendants;
+    append_u32(descendants, num_descendants);
+    this->nodes.replace(pos + node_field::num_descendants * sizeof(uint32_t),
+                        sizeof(uint32_t), descendants);
+
+    return num_descendants + 1;
+  }
+};
+} // namespace
+
+void curlydoc::write_binary(const tml::forest_ext &forest, output_sink &out) {
+  binary_writer w;
+
+  for (const auto &t : forest) {
+    w.write(t);
+  }
+
+  std::string header(magic.data(), magic.size());
+  append_u32(header, format_version);
+  append_u32(header, w.num_strings);
+  append_u32(header, w.num_nodes);
+  append_u32(header, w.string_data.size());
+
+  out << header << w.string_table << w.nodes << w.string_data;
+}
+
+binary_forest::binary_forest(utki::span<const uint8_t> data) {
+  auto throw_invalid = [](const char *what) {
+    throw std::invalid_argument(std::string("binary_forest(): ") + what);
+  };
+
+  if (data.size() < header_size ||
+      !std::equal(magic.begin(), magic.end(), data.begin())) {
+    throw_invalid("not a binary forest");
+  }
+
+  const uint8_t *p = data.data() + magic.size();
+
+  if (read_u32(p) != format_version) {
+    throw_invalid("unsupported format version");
+  }
+  p += sizeof(uint32_t);
+
+  size_t num_strings = read_u32(p);
+  p += sizeof(uint32_t);
+  this->num_nodes = read_u32(p);
+  p += sizeof(uint32_t);
+  size_t string_data_size = read_u32(p);
+
+  size_t string_table_size = num_strings * string_entry_size;
+  size_t nodes_size = this->num_nodes * node_size;
+
+  if (data.size() !=
+      header_size + string_table_size + nodes_size + string_data_size) {
+    throw_invalid("data size mismatch");
+  }
+
+  this->string_table =
+      utki::make_span(data.data() + header_size, string_table_size);
+  this->nodes = utki::make_span(this->string_table.end(), nodes_size);
+  this->string_data = std::string_view(
+      reinterpret_cast<const char *>(this->nodes.end()), string_data_size);
+
+  for (size_t i = 0; i != num_strings; ++i) {
+    const uint8_t *entry = this->string_table.data() + i * string_entry_size;
+    size_t offset = read_u32(entry);
+    size_t size = read_u32(entry + sizeof(uint32_t));
+    if (offset > string_data_size || size > string_data_size - offset) {
+      throw_invalid("string is out of bounds");
+    }
+  }
+
+  // ends of the nodes enclosing the current one, descendants of a node must
+  // not go past the end of its parent
+  std::vector<size_t> ends = {this->num_nodes};
+
+  for (size_t i = 0; i != this->num_nodes; ++i) {
+    if (this->get(i, node_field::string_index) >= num_strings) {
+      throw_invalid("string index is out of bounds");
+    }
+
+    while (ends.back() == i) {
+      ends.pop_back();
+    }
+
+    size_t end = i + 1 + this->get(i, node_field::num_descendants);
+    if (end > ends.back()) {
+      throw_invalid("node descendants are out of bounds");
+    }
+    ends.push_back(end);
+  }
+}
+
+uint32_t binary_forest::get(size_t node, size_t field) const noexcept {
+  return read_u32(this->nodes.data() + node * node_size +
+                  field * sizeof(uint32_t));
+}
+
+size_t binary_forest::next(size_t node) const noexcept {
+  return node + 1 + this->get(node, node_field::num_descendants);
+}
+
+std::string_view binary_forest::value(size_t node) const noexcept {
+  const uint8_t *entry = this->string_table.data() +
+                         this->get(node, node_field::string_index) *
+                             string_entry_size;
+  return this->string_data.substr(read_u32(entry),
+                                  read_u32(entry + sizeof(uint32_t)));
+}
+
+tml::extra_info binary_forest::info(size_t node) const noexcept {
+  tml::extra_info ret;
+  ret.location.line = this->get(node, node_field::line);
+  ret.location.offset = this->get(node, node_field::offset);
+
+  uint32_t flags = this->get(node, node_field::flags);
+  for (size_t i = 0; i != size_t(tml::flag::enum_size); ++i) {
+    if (flags & (1 << i)) {
+      ret.flags.set(tml::flag(i));
+    }
+  }
+  return ret;
+}
+
+tml::tree_ext binary_forest::to_tree(size_t node) const {
+  tml::tree_ext ret(tml::leaf_ext(std::string(this->value(node)),
+                                  this->info(node)));
+
+  size_t end = this->next(node);
+  for (size_t c = node + 1; c != end; c = this->next(c)) {
+    ret.children.push_back(this->to_tree(c));
+  }
+
+  return ret;
+}
+
+tml::forest_ext binary_forest::to_forest() const {
+  tml::forest_ext ret;
+  for (size_t i = 0; i != this->num_nodes; i = this->next(i)) {
+    ret.push_back(this->to_tree(i));
+  }
+  return ret;
+}
@@ -0,0 +1,80 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include <tml/tree_ext.hpp>
+#include <utki/span.hpp>
+
+#include "output_sink.hpp"
+
+namespace curlydoc {
+
+// Binary representation of a forest, so that evaluated documents can be
+// stored and translated later without parsing them again.
+//
+// All numbers are 32 bit little-endian. The layout is:
+// - header: magic, format version, number of strings, number of nodes,
+//   size of string data;
+// - string table: offset and size of each string within the string data;
+// - nodes in depth-first order: string index, line, offset, flags and
+//   number of descendants;
+// - string data.
+//
+// Equal strings are stored only once. Descendants of a node immediately
+// follow it, so the forest can be walked in place, e.g. in a mapped file.
+void write_binary(const tml::forest_ext &forest, output_sink &out);
+
+// View of a forest in binary representation, the data is not copied.
+// Nodes are identified by their indices, node 0 is the first root node.
+class binary_forest {
+  utki::span<const uint8_t> string_table;
+  utki::span<const uint8_t> nodes;
+  std::string_view string_data;
+
+  size_t num_nodes;
+
+  uint32_t get(size_t node, size_t field) const noexcept;
+
+public:
+  // Throws std::invalid_argument if the data is not a valid binary forest.
+  explicit binary_forest(utki::span<const uint8_t> data);
+
+  // total number of nodes
+  size_t size() const noexcept { return this->num_nodes; }
+
+  // Index of the node following the node and all its descendants.
+  // Children of a node are [node + 1, next(node)).
+  size_t next(size_t node) const noexcept;
+
+  std::string_view value(size_t node) const noexcept;
+
+  tml::extra_info info(size_t node) const noexcept;
+
+  tml::tree_ext to_tree(size_t node) const;
+
+  tml::forest_ext to_forest() const;
+};
+
+} // namespace curlydoc
@@ -0,0 +1,85 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "forest_view.hpp"
+
+using namespace curlydoc;
+
+void forest_view::append(utki::span<const tml::tree_ext> nodes,
+                         std::optional<bool> first_space) {
+  if (nodes.empty()) {
+    return;
+  }
+  this->parts.push_back({nodes, first_space});
+  this->num_nodes += nodes.size();
+}
+
+void forest_view::append(std::shared_ptr<const tml::forest_ext> forest,
+                         std::optional<bool> first_space) {
+  ASSERT(forest)
+  if (forest->empty()) {
+    return;
+  }
+  this->append(utki::make_span(*forest), first_space);
+  this->shared.push_back(std::move(forest));
+}
+
+void forest_view::append(tml::forest_ext &&forest) {
+  if (forest.empty()) {
+    return;
+  }
+  // NOTE: moving the forest object does not move its nodes, so the span
+  //       stays valid
+  this->owned.push_back(std::move(forest));
+  this->append(utki::make_span(this->owned.back()));
+}
+
+tml::forest_ext forest_view::copy(size_t begin, size_t end) const {
+  ASSERT(begin <= end)
+  ASSERT(end <= this->size())
+
+  tml::forest_ext ret;
+  ret.reserve(end - begin);
+
+  size_t offset = 0;
+  for (const auto &p : this->parts) {
+    if (offset >= end) {
+      break;
+    }
+
+    size_t part_end = offset + p.nodes.size();
+    if (part_end > begin) {
+      size_t b = begin > offset ? begin - offset : 0;
+      size_t e = std::min(end, part_end) - offset;
+
+      auto first = ret.insert(ret.end(), std::next(p.nodes.begin(), b),
+                              std::next(p.nodes.begin(), e));
+
+      if (b == 0 && p.first_space.has_value()) {
+        first->value.info.flags.set(tml::flag::space, p.first_space.value());
+      }
+    }
+
+    offset = part_end;
+  }
+
+  return ret;
+}
@@ -0,0 +1,135 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <tml/tree_ext.hpp>
+
+namespace curlydoc {
+
+// Read-only sequence of tree nodes assembled from spans of other forests.
+// The view keeps shared forests it refers to alive, this allows accessing
+// variable values without copying them.
+class forest_view {
+  struct part {
+    utki::span<const tml::tree_ext> nodes;
+
+    // if set, overrides space flag of the first node when copying
+    std::optional<bool> first_space;
+  };
+
+  std::vector<part> parts;
+
+  std::vector<std::shared_ptr<const tml::forest_ext>> shared;
+  std::vector<tml::forest_ext> owned;
+
+  size_t num_nodes = 0;
+
+public:
+  // append span of nodes which is owned by someone else and outlives the view
+  void append(utki::span<const tml::tree_ext> nodes,
+              std::optional<bool> first_space = {});
+
+  void append(std::shared_ptr<const tml::forest_ext> forest,
+              std::optional<bool> first_space = {});
+
+  void append(tml::forest_ext &&forest);
+
+  class const_iterator {
+    friend class forest_view;
+
+    decltype(parts)::const_iterator part;
+    size_t index = 0;
+
+    const_iterator(decltype(part) part, size_t index)
+        : part(part), index(index) {}
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = tml::tree_ext;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const tml::tree_ext *;
+    using reference = const tml::tree_ext &;
+
+    const_iterator() = default;
+
+    reference operator*() const noexcept { return this->part->nodes[index]; }
+
+    pointer operator->() const noexcept { return &this->operator*(); }
+
+    const_iterator &operator++() noexcept {
+      ++this->index;
+      if (this->index == this->part->nodes.size()) {
+        ++this->part;
+        this->index = 0;
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) noexcept {
+      auto ret = *this;
+      this->operator++();
+      return ret;
+    }
+
+    bool operator==(const const_iterator &i) const noexcept {
+      return this->part == i.part && this->index == i.index;
+    }
+
+    bool operator!=(const const_iterator &i) const noexcept {
+      return !this->operator==(i);
+    }
+  };
+
+  const_iterator begin() const noexcept {
+    return const_iterator(this->parts.begin(), 0);
+  }
+
+  const_iterator end() const noexcept {
+    return const_iterator(this->parts.end(), 0);
+  }
+
+  size_t size() const noexcept { return this->num_nodes; }
+
+  bool empty() const noexcept { return this->num_nodes == 0; }
+
+  const tml::tree_ext &front() const noexcept {
+    ASSERT(!this->empty())
+    return this->parts.front().nodes.front();
+  }
+
+  const tml::tree_ext &back() const noexcept {
+    ASSERT(!this->empty())
+    return this->parts.back().nodes.back();
+  }
+
+  // copy nodes in range [begin, end) to a forest
+  tml::forest_ext copy(size_t begin, size_t end) const;
+
+  tml::forest_ext copy() const { return this->copy(0, this->size()); }
+};
+
+} // namespace curlydoc
@@ -0,0 +1,125 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "include_cache.hpp"
+
+#include <papki/fs_file.hpp>
+
+#include "mapped_file.hpp"
+#include "memory_accounting.hpp"
+
+using namespace curlydoc;
+
+uint64_t curlydoc::hash_contents(utki::span<const uint8_t> data,
+                                 uint64_t hash) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  constexpr uint64_t prime = 0x100000001b3;
+
+  for (auto b : data) {
+    hash ^= b;
+    hash *= prime;
+  }
+  return hash;
+}
+
+tml::forest_ext curlydoc::read_forest(const papki::file &file,
+                                      uint64_t *contents_hash) {
+  memory_accounting::phase_scope phase_scope(memory_accounting::phase::parse);
+
+  if (!dynamic_cast<const papki::fs_file *>(&file)) {
+    if (!contents_hash) {
+      return tml::read_ext(file);
+    }
+
+    auto data = file.load();
+    *contents_hash = hash_contents(utki::make_span(data));
+    return tml::read_ext(std::string_view(
+        reinterpret_cast<const char *>(data.data()), data.size()));
+  }
+
+  mapped_file mapped(file.path());
+  if (contents_hash) {
+    *contents_hash = hash_contents(mapped.data());
+  }
+  return tml::read_ext(mapped.str());
+}
+
+std::shared_ptr<const tml::forest_ext>
+include_cache::get(const papki::file &file, uint64_t *contents_hash) {
+  std::error_code ec;
+
+  auto path = std::filesystem::canonical(file.path(), ec);
+  if (ec) {
+    return std::make_shared<const tml::forest_ext>(
+        read_forest(file, contents_hash));
+  }
+
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return std::make_shared<const tml::forest_ext>(
+        read_forest(file, contents_hash));
+  }
+
+  auto size = std::filesystem::file_size(path, ec);
+  if (ec) {
+    return std::make_shared<const tml::forest_ext>(
+        read_forest(file, contents_hash));
+  }
+
+  auto key = path.string();
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto i = this->entries.find(key);
+    if (i != this->entries.end() && i->second.mtime == mtime &&
+        i->second.size == size) {
+      if (contents_hash) {
+        *contents_hash = i->second.contents_hash;
+      }
+      return i->second.forest;
+    }
+  }
+
+  // parse without holding the lock, so that other files can be parsed
+  // concurrently, in the worst case the same file is parsed twice
+  uint64_t hash = 0;
+  auto forest =
+      std::make_shared<const tml::forest_ext>(read_forest(file, &hash));
+
+  if (contents_hash) {
+    *contents_hash = hash;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->entries[key] = entry{mtime, size, forest, hash};
+
+  return forest;
+}
+
+size_t include_cache::size() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->entries.size();
+}
+
+void include_cache::clear() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->entries.clear();
+}
@@ -0,0 +1,83 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <papki/file.hpp>
+#include <tml/tree_ext.hpp>
+#include <utki/span.hpp>
+
+namespace curlydoc {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+constexpr uint64_t initial_contents_hash = 0xcbf29ce484222325;
+
+// 64-bit FNV-1a hash of file contents, used to detect changed files.
+// Contents read in parts are hashed by passing the hash of the preceding
+// parts as the initial value.
+uint64_t hash_contents(utki::span<const uint8_t> data,
+                       uint64_t hash = initial_contents_hash) noexcept;
+
+// Parse the file. Files on the filesystem are mapped to memory and parsed
+// from there, instead of being read in chunks through the papki::file.
+// If contents_hash is not null, the hash of the parsed contents is stored
+// there, it matches what was parsed even if the file is changed afterwards.
+tml::forest_ext read_forest(const papki::file &file,
+                            uint64_t *contents_hash = nullptr);
+
+// Cache of parsed files.
+// Files are identified by canonical path and are parsed again if their
+// modification time or size changes. The cache is thread-safe, so it can be
+// shared between interpreters processing different documents.
+class include_cache {
+  struct entry {
+    std::filesystem::file_time_type mtime;
+    uintmax_t size;
+    std::shared_ptr<const tml::forest_ext> forest;
+    uint64_t contents_hash;
+  };
+
+  mutable std::mutex mutex;
+
+  // key is the canonical path
+  std::unordered_map<std::string, entry> entries;
+
+public:
+  // Get parsed contents of the file at the current path of the given file
+  // object. Files not residing in the file system are parsed each time.
+  // If contents_hash is not null, the hash of the contents the returned
+  // forest was parsed from is stored there, see hash_contents().
+  std::shared_ptr<const tml::forest_ext>
+  get(const papki::file &file, uint64_t *contents_hash = nullptr);
+
+  size_t size() const;
+
+  void clear();
+};
+
+} // namespace curlydoc
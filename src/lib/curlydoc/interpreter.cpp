@@ -21,46 +21,310 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "interpreter.hpp"
 
+#include <algorithm>
+
 #include <utki/util.hpp>
 
 using namespace curlydoc;
 
+namespace {
+// total size of strings of the nodes
+size_t count_bytes(tml::forest_ext::const_iterator begin,
+                   tml::forest_ext::const_iterator end) noexcept {
+  size_t ret = 0;
+  for (auto i = begin; i != end; ++i) {
+    ret += i->value.string.size() +
+           count_bytes(i->children.begin(), i->children.end());
+  }
+  return ret;
+}
+} // namespace
+
+namespace {
+// profiles a call, the call output is appended to the given forest
+class profile_scope {
+  profiler &prof;
+  const tml::forest_ext &out;
+  size_t out_begin;
+  std::optional<size_t> output_bytes;
+
+public:
+  profile_scope(profiler &prof, size_t entry, const tml::forest_ext &out)
+      : prof(prof), out(out), out_begin(out.size()) {
+    this->prof.begin(entry);
+  }
+
+  profile_scope(const profile_scope &) = delete;
+  profile_scope &operator=(const profile_scope &) = delete;
+
+  profile_scope(profile_scope &&) = delete;
+  profile_scope &operator=(profile_scope &&) = delete;
+
+  // set output size if it is already known, to avoid counting it again
+  void set_output_bytes(size_t bytes) noexcept { this->output_bytes = bytes; }
+
+  ~profile_scope() {
+    if (!this->output_bytes) {
+      this->output_bytes = this->prof.pause([this]() {
+        return count_bytes(utki::next(this->out.begin(), this->out_begin),
+                           this->out.end());
+      });
+    }
+    this->prof.end(this->output_bytes.value());
+  }
+};
+} // namespace
+
 interpreter::exception::exception(const std::string &message)
-    : std::invalid_argument(message + " at:") {}
-
-interpreter::exception::exception(const std::string &message,
-                                  const std::string &file,
-                                  const tml::leaf_ext &leaf)
-    : std::invalid_argument([&]() {
-        const auto &l = leaf.info.location;
-        std::stringstream ss;
-        ss << message << '\n';
-        ss << "    " << file << ":" << l.line << ":" << l.offset << ": "
-           << leaf.string;
-        return ss.str();
-      }()) {}
-
-void interpreter::add_function(const std::string &name, function_type &&func) {
-  auto res = this->functions.insert(std::make_pair(name, std::move(func)));
-  if (!res.second) {
+    : std::invalid_argument(message + " at:"), message(message + " at:"),
+      text(this->message) {}
+
+void interpreter::exception::add_call(const std::string &file,
+                                      const tml::leaf_ext &leaf) {
+  const auto &l = leaf.info.location;
+  std::stringstream ss;
+  ss << "    " << file << ":" << l.line << ":" << l.offset << ": "
+     << leaf.string;
+
+  if (this->innermost_calls.size() != max_shown_calls) {
+    this->innermost_calls.push_back(ss.str());
+  } else {
+    this->outermost_calls.push_back(ss.str());
+    if (this->outermost_calls.size() > max_shown_calls) {
+      this->outermost_calls.pop_front();
+      ++this->num_skipped_calls;
+    }
+  }
+
+  // the backtrace is bounded, so formatting it each time a call is added
+  // keeps the total time linear in the nesting depth
+  this->text = this->message;
+  for (const auto &c : this->innermost_calls) {
+    this->text.append("\n").append(c);
+  }
+  if (this->num_skipped_calls != 0) {
+    this->text.append("\n    ... ")
+        .append(std::to_string(this->num_skipped_calls))
+        .append(" more calls ...");
+  }
+  for (const auto &c : this->outermost_calls) {
+    this->text.append("\n").append(c);
+  }
+}
+
+const char *interpreter::exception::what() const noexcept {
+  return this->text.c_str();
+}
+
+void interpreter::add_function(const std::string &name, function_type &&func,
+                               bool pure) {
+  ASSERT(func)
+
+  auto id = this->symbols.intern(name);
+
+  if (this->find_function(id)) {
     std::stringstream ss;
     ss << "function '" << name << "' is already added";
     throw std::logic_error(ss.str());
   }
+
+  // the function table is shared with snapshots, copy it before modifying
+  if (this->functions.use_count() != 1) {
+    this->functions = std::make_shared<function_table>(*this->functions);
+  }
+
+  if (id >= this->functions->size()) {
+    this->functions->resize(id + 1);
+  }
+
+  auto &f = (*this->functions)[id];
+  f.func = std::move(func);
+  f.pure = pure;
+}
+
+interpreter::snapshot::snapshot(interpreter &owner)
+    : functions(owner.functions), if_state(owner.if_flag_stack.front()),
+      memoize(owner.memoize),
+      max_memo_cache_size(owner.max_memo_cache_size), lim(owner.lim),
+      included_files(owner.included_files) {
+  // snapshot can only be taken between evaluations
+  ASSERT(owner.if_flag_stack.size() == 1)
+  ASSERT(owner.memo_stack.empty())
+
+  // compiling adds names to the symbol table, so compile before copying it
+  owner.ctx.for_each_definition([&owner](const context::definition &d) {
+    if (!d.compiled) {
+      d.compiled = owner.compile(d.value);
+    }
+  });
+
+  this->symbols = owner.symbols;
+  this->ctx = owner.ctx;
+}
+
+interpreter::snapshot interpreter::make_snapshot() { return snapshot(*this); }
+
+interpreter::interpreter(const snapshot &snap,
+                         std::unique_ptr<papki::file> file)
+    : file_name_stack{"unknown"}, symbols(snap.symbols),
+      functions(snap.functions), ctx(snap.ctx), if_flag_stack{snap.if_state},
+      lim(snap.lim), memoize(snap.memoize),
+      max_memo_cache_size(snap.max_memo_cache_size), file(std::move(file)),
+      included_files(snap.included_files) {}
+
+namespace {
+size_t hash_combine(size_t seed, size_t value) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+} // namespace
+
+namespace {
+// NOTE: space flag is taken into account since it affects translation
+size_t hash_forest(const tml::forest_ext &forest) noexcept {
+  size_t ret = forest.size();
+  for (const auto &t : forest) {
+    ret = hash_combine(ret, std::hash<std::string>()(t.value.string));
+    ret = hash_combine(ret, t.value.info.flags.get(tml::flag::space));
+    ret = hash_combine(ret, hash_forest(t.children));
+  }
+  return ret;
+}
+} // namespace
+
+namespace {
+bool is_same(const tml::forest_ext &a, const tml::forest_ext &b) noexcept {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+    if (i->value.string != j->value.string ||
+        i->value.info.flags.get(tml::flag::space) !=
+            j->value.info.flags.get(tml::flag::space) ||
+        !is_same(i->children, j->children)) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+void interpreter::enable_memoization(bool enable) {
+  ASSERT(this->memo_stack.empty())
+  this->memoize = enable;
+  if (!enable) {
+    this->memo_cache.clear();
+    this->memo_cache_size = 0;
+  }
+}
+
+void interpreter::add_memo_entry(size_t hash, memo_entry &&e) {
+  // the arguments are shared with the '@' definition of the macro scope
+  // being finished, so they are accounted to the cache as well
+  size_t size = sizeof(e) + count_bytes(e.args->begin(), e.args->end()) +
+                count_bytes(e.output.begin(), e.output.end()) +
+                (e.args->size() + e.output.size()) * sizeof(tml::tree_ext);
+
+  if (size > this->max_memo_cache_size) {
+    return;
+  }
+
+  // simply start over when the cache is full, this keeps the cache bounded
+  // without the bookkeeping of finer eviction policies
+  if (this->memo_cache_size + size > this->max_memo_cache_size) {
+    this->memo_cache.clear();
+    this->memo_cache_size = 0;
+  }
+
+  this->memo_cache.insert(std::make_pair(hash, std::move(e)));
+  this->memo_cache_size += size;
+}
+
+void interpreter::set_include_cache(std::shared_ptr<include_cache> cache) {
+  ASSERT(cache)
+  this->included_files = std::move(cache);
+}
+
+void interpreter::start_budget() {
+  if (this->usage.depth != 0) {
+    return;
+  }
+
+  this->usage = budget();
+
+  if (this->lim.max_time.count() != 0) {
+    this->usage.deadline =
+        std::chrono::steady_clock::now() + this->lim.max_time;
+  }
+}
+
+void interpreter::throw_nodes_limit_exceeded() const {
+  throw exception(std::string("output node limit (") +
+                  std::to_string(this->lim.max_nodes) + ") exceeded");
+}
+
+void interpreter::check_call() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  constexpr size_t time_check_interval = 0x100;
+
+  if (this->lim.max_time.count() != 0 &&
+      ++this->usage.calls % time_check_interval == 0 &&
+      std::chrono::steady_clock::now() > this->usage.deadline) {
+    throw exception(std::string("time limit (") +
+                    std::to_string(this->lim.max_time.count()) +
+                    " ms) exceeded");
+  }
+}
+
+void interpreter::mark_impure() noexcept {
+  for (auto &f : this->memo_stack) {
+    f.impure = true;
+  }
+}
+
+interpreter::bool_state &interpreter::read_if_state() {
+  // reading the flag of the caller's scope, which was not set by the macro
+  // itself, makes the macro impure
+  for (auto i = this->memo_stack.rbegin(); i != this->memo_stack.rend();
+       ++i) {
+    if (i->if_depth != this->if_flag_stack.size()) {
+      break;
+    }
+    if (!i->wrote_if_state) {
+      i->impure = true;
+    }
+  }
+  return this->if_flag_stack.back();
+}
+
+interpreter::bool_state &interpreter::write_if_state() {
+  for (auto i = this->memo_stack.rbegin(); i != this->memo_stack.rend();
+       ++i) {
+    if (i->if_depth != this->if_flag_stack.size()) {
+      break;
+    }
+    i->wrote_if_state = true;
+  }
+  return this->if_flag_stack.back();
 }
 
 void interpreter::add_repeater_function(const std::string &name) {
-  this->add_function(name, [this, name](const tml::forest_ext &args) {
+  this->add_function(name, [name](interpreter &self,
+                                  const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
+    self.use_nodes(1);
+
     tml::forest_ext ret;
     ret.emplace_back(name);
 
-    ret.front().children = this->eval(args);
+    ret.front().children = self.eval(args);
 
     return ret;
   });
+
+  (*this->functions)[this->symbols.intern(name)].repeater = true;
 }
 
 void interpreter::add_repeater_functions(utki::span<const std::string> names) {
@@ -69,69 +333,136 @@ void interpreter::add_repeater_functions(utki::span<const std::string> names) {
   }
 }
 
-void interpreter::context::add(const std::string &name,
-                               tml::forest_ext &&value) {
-  auto i = this->defs.insert(std::make_pair(name, std::move(value)));
-  if (!i.second) {
+interpreter::context::context() {
+  // root scope
+  this->scopes.push_back({npos, 0, 0});
+}
+
+void interpreter::context::push(size_t parent) {
+  ASSERT(parent < this->scopes.size())
+
+  size_t index = this->scopes.size();
+  this->scopes.push_back(
+      {parent, parent + 1 == index ? this->scopes[parent].base : index,
+       this->defs.size()});
+}
+
+void interpreter::context::pop_to(size_t size) noexcept {
+  ASSERT(size >= 1) // root scope is never popped
+  ASSERT(size <= this->scopes.size())
+
+  if (size == this->scopes.size()) {
+    return;
+  }
+
+  size_t defs_end = this->scopes[size].defs_begin;
+
+  while (this->defs.size() != defs_end) {
+    const auto &b = this->defs.back();
+    this->latest[b.name] = b.shadowed;
+    this->defs.pop_back();
+  }
+
+  this->scopes.resize(size);
+}
+
+void interpreter::context::add(symbol_id name,
+                               std::shared_ptr<const tml::forest_ext> value,
+                               std::shared_ptr<const std::string> site) {
+  ASSERT(value)
+
+  if (name >= this->latest.size()) {
+    this->latest.resize(name + 1, npos);
+  }
+
+  auto &latest = this->latest[name];
+
+  if (latest != npos && this->defs[latest].scope == this->top()) {
     throw exception("variable name already exists in this context");
   }
+
+  this->defs.push_back({name,
+                        this->top(),
+                        latest,
+                        {std::move(value), nullptr, std::move(site)}});
+  latest = this->defs.size() - 1;
 }
 
-interpreter::context::find_result
-interpreter::context::try_find(const std::string &name) const {
-  auto i = this->defs.find(name);
-  if (i == this->defs.end()) {
-    if (this->prev) {
-      return this->prev->try_find(name);
+bool interpreter::context::is_visible(size_t scope,
+                                      size_t from) const noexcept {
+  while (from > scope) {
+    const auto &s = this->scopes[from];
+    if (s.base <= scope) {
+      return true;
     }
-    return {nullptr, *this};
+    // NOTE: root scope has base of 0, so the loop will always end before
+    //       reaching npos parent
+    from = this->scopes[s.base].parent;
   }
-  ASSERT(this->prev)
-  return {&i->second, *this->prev};
+  return from == scope;
 }
 
-const tml::forest_ext &
-interpreter::context::find(const std::string &name) const {
-  auto v = this->try_find(name);
+interpreter::context::find_result
+interpreter::context::try_find(symbol_id name) const noexcept {
+  if (name >= this->latest.size()) {
+    return {nullptr, npos};
+  }
 
-  if (!v.value) {
-    throw exception(std::string("variable '") + name + "' not found");
+  for (size_t i = this->latest[name]; i != npos; i = this->defs[i].shadowed) {
+    const auto &b = this->defs[i];
+    if (this->is_visible(b.scope, this->top())) {
+      ASSERT(b.scope != 0) // root scope has no definitions
+      return {&b.def, this->scopes[b.scope].parent};
+    }
   }
 
-  return *v.value;
+  return {nullptr, npos};
+}
+
+void interpreter::add_definition(const std::string &name,
+                                 tml::forest_ext &&value,
+                                 std::shared_ptr<const std::string> site) {
+  this->ctx.add(this->symbols.intern(name),
+                std::make_shared<const tml::forest_ext>(std::move(value)),
+                std::move(site));
 }
 
-interpreter::context &interpreter::push_context(const context *prev) {
-  if (!prev) {
-    prev = &this->context_stack.back();
+const std::shared_ptr<const tml::forest_ext> &
+interpreter::find_variable(const std::string &name) const {
+  auto id = this->symbols.find(name);
+  if (id) {
+    auto v = this->ctx.try_find(id.value());
+    if (v.def) {
+      return v.def->value;
+    }
   }
-  this->context_stack.emplace_back(prev);
-  return this->context_stack.back();
+
+  throw exception(std::string("variable '") + name + "' not found");
 }
 
 interpreter::interpreter(std::unique_ptr<papki::file> file)
     : file_name_stack{"unknown"}, file(std::move(file)) {
-  this->add_function("asis", [](const tml::forest_ext &args) {
+  this->add_function("asis", [](interpreter &, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
     return args;
   });
 
-  this->add_function("map", [this](const tml::forest_ext &args) {
+  this->add_function("map", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
     tml::forest_ext ret;
 
     for (const auto &a : args) {
-      ret.emplace_back(a.value, this->eval(a.children));
+      ret.emplace_back(a.value, self.eval(a.children));
     }
 
     return ret;
   });
 
-  this->add_function("prm", [this](const tml::forest_ext &args) {
+  this->add_function("prm", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
@@ -139,35 +470,44 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
     ret.emplace_back("prm");
 
     for (const auto &a : args) {
-      ret.back().children.emplace_back(a.value, this->eval(a.children));
+      ret.back().children.emplace_back(a.value, self.eval(a.children));
     }
 
     return ret;
   });
 
-  this->add_function("defs", [this](const tml::forest_ext &args) {
+  this->add_function("defs", [](interpreter &self,
+                                const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto &ctx = this->push_context();
+    self.ctx.push();
 
     for (const auto &c : args) {
       try {
-        ctx.add(c.value.string, this->eval(c.children));
+        std::shared_ptr<const std::string> site;
+        if (self.prof) {
+          const auto &l = c.value.info.location;
+          std::stringstream ss;
+          ss << self.file_name_stack.back() << ":" << l.line << ":"
+             << l.offset;
+          site = std::make_shared<const std::string>(ss.str());
+        }
+        self.add_definition(c.value.string, self.eval(c.children),
+                            std::move(site));
       } catch (exception &e) {
-        throw exception(e.what(), this->file_name_stack.back(), c.value);
+        e.add_call(self.file_name_stack.back(), c.value);
+        throw;
       }
     }
     return tml::forest_ext();
   });
 
-  this->add_function("$", [this](const tml::forest_ext &args) {
+  this->add_function("$", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    ASSERT(!this->context_stack.empty())
-
-    auto res = this->eval(args);
+    auto res = self.eval(args);
 
     if (res.empty()) {
       throw exception("variable name is not given");
@@ -178,149 +518,146 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
 
     const auto &name = res.front().value.string;
 
-    const auto &val = this->context_stack.back().find(name);
-
-    return val;
+    return *self.find_variable(name);
   });
 
-  this->add_function("for", [this](const tml::forest_ext &args) {
+  this->add_function("for", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto iter_name = args[0].value.string;
-    auto iter_values = this->eval(args[0].children);
+    auto iter_symbol = self.symbols.intern(args[0].value.string);
+    auto iter_values = self.eval_view(args[0].children);
 
     tml::forest_ext ret;
 
     for (const auto &i : iter_values) {
-      auto &ctx = this->push_context();
-      utki::scope_exit context_scope_exit(
-          [this]() { this->context_stack.pop_back(); });
+      self.ctx.push();
+      utki::scope_exit context_scope_exit([&self]() { self.ctx.pop(); });
 
       try {
-        ctx.add(iter_name, {i});
+        self.ctx.add(iter_symbol, std::make_shared<const tml::forest_ext>(
+                                       tml::forest_ext{i}));
         // do not add in case name already exists
         // NOLINTNEXTLINE(bugprone-empty-catch)
       } catch (exception &) {
         ASSERT(false)
       }
 
-      auto output = this->eval(std::next(args.begin()), args.end());
-
-      ret.insert(ret.end(), std::make_move_iterator(output.begin()),
-                 std::make_move_iterator(output.end()));
+      self.eval_to(std::next(args.begin()), args.end(), ret);
     }
 
     return ret;
   });
 
-  this->add_function("if", [this](const tml::forest_ext &args) {
+  this->add_function("if", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    bool flag = [this, &args]() {
-      if_flag_push if_flag_push(*this);
-      return !this->eval(args).empty();
+    bool flag = [&self, &args]() {
+      if_flag_push if_flag_push(self);
+      return !self.eval_view(args).empty();
     }();
 
-    auto &bs = this->if_flag_stack.back();
+    auto &bs = self.write_if_state();
     bs.flag = flag;
     bs.true_before_or = false;
 
     return tml::forest_ext();
   });
 
-  this->add_function("then", [this](const tml::forest_ext &args) {
+  this->add_function("then", [](interpreter &self,
+                                const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto &bs = this->if_flag_stack.back();
+    const auto &bs = self.read_if_state();
 
     if (!bs.flag) {
       return tml::forest_ext();
     }
 
-    if_flag_push if_flag_push(*this);
+    if_flag_push if_flag_push(self);
 
-    return this->eval(args);
+    return self.eval(args);
   });
 
-  this->add_function("else", [this](const tml::forest_ext &args) {
+  this->add_function("else", [](interpreter &self,
+                                const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto &bs = this->if_flag_stack.back();
+    const auto &bs = self.read_if_state();
 
     if (bs.flag) {
       return tml::forest_ext();
     }
 
-    if_flag_push if_flag_push(*this);
+    if_flag_push if_flag_push(self);
 
-    return this->eval(args);
+    return self.eval(args);
   });
 
-  this->add_function("and", [this](const tml::forest_ext &args) {
+  this->add_function("and", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
     {
-      auto &bs = this->if_flag_stack.back();
+      const auto &bs = self.read_if_state();
 
       if (!bs.flag || bs.true_before_or) {
         return tml::forest_ext();
       }
     }
 
-    bool flag = [this, &args]() {
-      if_flag_push if_flag_push(*this);
-      return !this->eval(args).empty();
+    bool flag = [&self, &args]() {
+      if_flag_push if_flag_push(self);
+      return !self.eval_view(args).empty();
     }();
 
-    this->if_flag_stack.back().flag = flag;
+    self.write_if_state().flag = flag;
 
     return tml::forest_ext();
   });
 
-  this->add_function("or", [this](const tml::forest_ext &args) {
+  this->add_function("or", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
     {
-      auto &bs = this->if_flag_stack.back();
+      const auto &bs = self.read_if_state();
 
       if (bs.flag) {
-        bs.true_before_or = true;
+        self.write_if_state().true_before_or = true;
         return tml::forest_ext();
       }
     }
 
-    bool flag = [this, &args]() {
-      if_flag_push if_flag_push(*this);
-      return !this->eval(args).empty();
+    bool flag = [&self, &args]() {
+      if_flag_push if_flag_push(self);
+      return !self.eval_view(args).empty();
     }();
 
-    this->if_flag_stack.back().flag = flag;
+    self.write_if_state().flag = flag;
 
     return tml::forest_ext();
   });
 
-  this->add_function("not", [this](const tml::forest_ext &args) {
+  this->add_function("not", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    if (this->eval(args).empty()) {
+    if (self.eval_view(args).empty()) {
       return tml::forest_ext{{"true"}};
     }
 
     return tml::forest_ext();
   });
 
-  this->add_function("eq", [this](const tml::forest_ext &args) {
+  this->add_function("eq", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto res = this->eval(args);
+    auto res = self.eval_view(args);
 
     if (res.size() != 2) {
       throw exception("'eq' function requires exactly 2 arguments");
@@ -332,11 +669,11 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
     return tml::forest_ext();
   });
 
-  this->add_function("gt", [this](const tml::forest_ext &args) {
+  this->add_function("gt", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto res = this->eval(args);
+    auto res = self.eval_view(args);
 
     if (res.size() != 2) {
       throw exception("'eq' function requires exactly 2 arguments");
@@ -348,43 +685,64 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
     return tml::forest_ext();
   });
 
-  this->add_function("include", [this](const tml::forest_ext &args) {
-    ASSERT(!args.empty()) // if there are no arguments, then it is not a
-                          // function call
+  this->add_function(
+      "include",
+      [](interpreter &self, const tml::forest_ext &args) {
+        ASSERT(!args.empty()) // if there are no arguments, then it is not a
+                              // function call
 
-    if (!this->file) {
-      throw exception("include is not supported");
-    }
+        if (!self.file) {
+          throw exception("include is not supported");
+        }
 
-    this->file->set_path(args.front().value.string);
+        self.file->set_path(args.front().value.string);
 
-    this->file_name_stack.push_back(this->file->path());
-    utki::scope_exit file_name_stack_scope_exit(
-        [this]() { this->file_name_stack.pop_back(); });
+        if (self.included_file_name_set.insert(self.file->path()).second) {
+          self.included_file_names.push_back(self.file->path());
+        }
 
-    return this->eval(tml::read_ext(*this->file), true);
-  });
+        self.file_name_stack.push_back(self.file->path());
+        utki::scope_exit file_name_stack_scope_exit(
+            [&self]() { self.file_name_stack.pop_back(); });
 
-  this->add_function("size", [this](const tml::forest_ext &args) {
+        tml::forest_ext ret;
+
+        std::optional<profile_scope> call_profile_scope;
+        if (self.prof) {
+          call_profile_scope.emplace(
+              *self.prof,
+              self.prof->get_entry(profiler::kind::include, self.file->path()),
+              ret);
+        }
+
+        uint64_t contents_hash = 0;
+        auto forest = self.included_files->get(*self.file, &contents_hash);
+        // if the file changes between inclusions, the first contents are
+        // reported, which do not match the file anymore
+        self.file_hashes.emplace(self.file->path(), contents_hash);
+
+        self.eval_to(forest->begin(), forest->end(), ret, true);
+
+        return ret;
+      },
+      false // included file contents can change between calls
+  );
+
+  this->add_function("size", [](interpreter &self,
+                                const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    // TODO: optimize for the case of size{${v}}, since variables are stored
-    // evaluated, no need to copy variable contents via eval()
-
-    auto res = this->eval(args);
+    auto res = self.eval_view(args);
 
     return tml::forest_ext{{std::to_string(res.size())}};
   });
 
-  this->add_function("at", [this](const tml::forest_ext &args) {
+  this->add_function("at", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    // TODO: optimize for the case of at{some_expr ${v}}, since variables are
-    // stored evaluated, no need to copy variable contents via eval()
-
-    auto res = this->eval(args);
+    auto res = self.eval_view(args);
 
     if (res.empty()) {
       throw exception("no index argument is given to 'at' function");
@@ -404,17 +762,14 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
       throw exception(ss.str());
     }
 
-    return tml::forest_ext{res[index + 1]};
+    return res.copy(size_t(index + 1), size_t(index + 2));
   });
 
-  this->add_function("get", [this](const tml::forest_ext &args) {
+  this->add_function("get", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    // TODO: optimize for the case of get{some_expr ${v}}, since variables are
-    // stored evaluated, no need to copy variable contents via eval()
-
-    auto res = this->eval(args);
+    auto res = self.eval_view(args);
 
     if (res.empty()) {
       throw exception("no key argument is given to 'get' function");
@@ -433,15 +788,12 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
     throw exception(ss.str());
   });
 
-  this->add_function("slice", [this](const tml::forest_ext &args) {
+  this->add_function("slice", [](interpreter &self,
+                                 const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    // TODO: optimize for the case of slice{some_expr some_expr ${v}}, since
-    // variables are stored evaluated, no need to copy variable contents via
-    // eval()
-
-    auto evaled = this->eval(args);
+    auto evaled = self.eval_view(args);
 
     if (evaled.size() < 2) {
       throw exception(
@@ -479,19 +831,15 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
       throw exception(ss.str());
     }
 
-    tml::forest_ext ret;
-
-    std::copy(std::next(evaled.begin(), begin + 2),
-              std::next(evaled.begin(), end + 2), std::back_inserter(ret));
-
-    return ret;
+    return evaled.copy(size_t(begin + 2), size_t(end + 2));
   });
 
-  this->add_function("is_word", [this](const tml::forest_ext &args) {
+  this->add_function("is_word", [](interpreter &self,
+                                   const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto res = this->eval(args);
+    auto res = self.eval_view(args);
 
     if (res.size() == 1 && res.front().children.empty()) {
       return tml::forest_ext{{"true"}};
@@ -499,13 +847,13 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
     return tml::forest_ext();
   });
 
-  this->add_function("val", [this](const tml::forest_ext &args) {
+  this->add_function("val", [](interpreter &self, const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
     tml::forest_ext ret;
 
-    auto evaled = this->eval(args);
+    auto evaled = self.eval_view(args);
 
     if (evaled.size() == 1) {
       ret.emplace_back(evaled.front().value);
@@ -516,11 +864,12 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
     return ret;
   });
 
-  this->add_function("children", [this](const tml::forest_ext &args) {
+  this->add_function("children", [](interpreter &self,
+                                    const tml::forest_ext &args) {
     ASSERT(!args.empty()) // if there are no arguments, then it is not a
                           // function call
 
-    auto evaled = this->eval(args);
+    auto evaled = self.eval_view(args);
 
     if (evaled.size() == 1) {
       return evaled.front().children;
@@ -534,90 +883,568 @@ interpreter::interpreter(std::unique_ptr<papki::file> file)
   this->init_std_lib();
 }
 
-tml::forest_ext interpreter::eval(tml::forest_ext::const_iterator begin,
-                                  tml::forest_ext::const_iterator end,
-                                  bool preserve_vars) {
-  tml::forest_ext ret;
+void interpreter::eval_to(tml::forest_ext::const_iterator begin,
+                          tml::forest_ext::const_iterator end,
+                          tml::forest_ext &out, bool preserve_vars) {
+  this->start_budget();
 
-  utki::scope_exit context_stack_scope_exit(
-      [this, context_stack_size = this->context_stack.size(), preserve_vars]() {
-        if (!preserve_vars) {
-          this->context_stack.resize(context_stack_size);
+  size_t base = this->num_frames;
+  this->push_forest_frame(begin, end, out, preserve_vars);
+  this->run(base);
+}
+
+void interpreter::eval_call(const tml::tree_ext &call,
+                            std::optional<symbol_id> symbol,
+                            tml::forest_ext &out) {
+  size_t base = this->num_frames;
+  this->start_call(call, symbol, out);
+  this->run(base);
+}
+
+interpreter::frame &interpreter::push_frame(frame::kind k,
+                                            tml::forest_ext &out) {
+  if (this->num_frames == this->frames.size()) {
+    this->frames.push_back(std::make_unique<frame>());
+  }
+
+  auto &f = *this->frames[this->num_frames];
+  ++this->num_frames;
+
+  f.k = k;
+  f.out = &out;
+  return f;
+}
+
+void interpreter::push_forest_frame(tml::forest_ext::const_iterator begin,
+                                    tml::forest_ext::const_iterator end,
+                                    tml::forest_ext &out, bool preserve_vars) {
+  // the output is usually not smaller than the input
+  if (out.empty()) {
+    out.reserve(std::distance(begin, end));
+  }
+
+  auto &f = this->push_frame(frame::kind::forest, out);
+  f.begin = begin;
+  f.end = end;
+  if (!preserve_vars) {
+    f.context_size = this->ctx.size();
+  }
+}
+
+void interpreter::pop_frame() noexcept {
+  ASSERT(this->num_frames != 0)
+
+  auto &f = *this->frames[this->num_frames - 1];
+
+  if (f.context_size != context::npos) {
+    this->ctx.pop_to(f.context_size);
+  }
+
+  if (f.memo_pushed) {
+    this->memo_stack.pop_back();
+  }
+
+  if (this->prof) {
+    if (f.profiled) {
+      this->prof->end(f.out_bytes);
+    }
+
+    // pass the output size to the frame below if it is the output of that
+    // frame too, or its evaled forest
+    if (this->num_frames > 1) {
+      auto &below = *this->frames[this->num_frames - 2];
+      if (below.out == f.out) {
+        below.out_bytes += f.out_bytes;
+      } else if (&below.evaled == f.out) {
+        below.evaled_bytes += f.out_bytes;
+      }
+    }
+  }
+
+  // release the references held by the frame, but keep it allocated
+  f = frame();
+  --this->num_frames;
+}
+
+void interpreter::run(size_t base) {
+  try {
+    while (this->num_frames != base) {
+      auto &f = *this->frames[this->num_frames - 1];
+
+      switch (f.k) {
+      case frame::kind::forest:
+        if (f.begin == f.end) {
+          this->pop_frame();
+        } else {
+          const auto &node = *f.begin;
+          ++f.begin;
+
+          if (node.children.empty()) {
+            this->use_nodes(1);
+            f.out->push_back(node);
+            f.out_bytes += node.value.string.size();
+          } else {
+            f.out_bytes += this->start_call(
+                node, this->symbols.find(node.value.string), *f.out);
+          }
         }
-      });
+        break;
+      case frame::kind::program:
+        if (f.next_instruction == f.prog->code.size()) {
+          this->pop_frame();
+        } else {
+          const auto &ins = f.prog->code[f.next_instruction];
+          ++f.next_instruction;
+
+          switch (ins.k) {
+          case program::kind::literal:
+            this->use_nodes(std::distance(ins.begin, ins.end));
+            f.out->insert(f.out->end(), ins.begin, ins.end);
+            if (this->prof) {
+              f.out_bytes += this->prof->pause(
+                  [&ins]() { return count_bytes(ins.begin, ins.end); });
+            }
+            break;
+          case program::kind::variable:
+            f.out_bytes += this->eval_variable(*ins.begin, ins.symbol, *f.out);
+            break;
+          case program::kind::call:
+            f.out_bytes += this->start_call(*ins.begin, ins.symbol, *f.out);
+            break;
+          }
+        }
+        break;
+      case frame::kind::macro_call:
+        if (f.expanding) {
+          this->finish_macro_call(f);
+        } else {
+          this->expand_macro(f);
+        }
+        break;
+      case frame::kind::repeater_call:
+        this->finish_repeater_call(f);
+        break;
+      }
+    }
+  } catch (exception &e) {
+    // add the calls being evaluated to the backtrace, innermost first,
+    // as the nested calls would do when evaluated recursively
+    while (this->num_frames != base) {
+      const auto &f = *this->frames[this->num_frames - 1];
+      if (f.call) {
+        e.add_call(this->file_name_stack.back(), f.call->value);
+      }
+      this->pop_frame();
+    }
+    throw;
+  } catch (...) {
+    while (this->num_frames != base) {
+      this->pop_frame();
+    }
+    throw;
+  }
+}
 
-  for (auto i = begin; i != end; ++i) {
-    try {
-      if (i->children.empty()) {
-        ret.push_back(*i);
-        continue;
+size_t interpreter::start_call(const tml::tree_ext &call,
+                               std::optional<symbol_id> symbol,
+                               tml::forest_ext &out) {
+  ASSERT(!call.children.empty())
+
+  // checking the pointer is all the profiling costs when it is off
+  std::optional<profile_scope> call_profile_scope;
+
+  try {
+    this->check_call();
+
+    if (!symbol) {
+      // the name was never interned, so there is no such function or macro
+      throw exception(std::string("function/macro '") + call.value.string +
+                      "' not found");
+    }
+
+    // search for macro
+    auto v = this->ctx.try_find(symbol.value());
+    if (v.def) {
+      if (!v.def->compiled) {
+        v.def->compiled = this->compile(v.def->value);
       }
 
-      tml::forest_ext output;
+      ++this->usage.expansions;
+      if (this->lim.max_expansions != 0 &&
+          this->usage.expansions > this->lim.max_expansions) {
+        throw exception(std::string("macro expansion limit (") +
+                        std::to_string(this->lim.max_expansions) +
+                        ") exceeded");
+      }
 
-      // search for macro
-      auto v = this->context_stack.back().try_find(i->value.string);
-      if (v.value) {
-        auto args = this->eval(i->children);
+      auto &f = this->push_frame(frame::kind::macro_call, out);
+      f.call = &call;
+      f.output_begin = out.size();
+
+      // NOTE: the definition object can be moved in memory when new
+      //       definitions are added, so take the program before evaluating
+      //       anything
+      f.macro = v.def->compiled;
+      f.macro_scope = v.scope;
+
+      if (this->prof) {
+        this->prof->begin(this->prof->get_entry(
+            profiler::kind::macro, call.value.string,
+            v.def->site ? *v.def->site : ""));
+        f.profiled = true;
+      }
 
-        auto &ctx = this->push_context(&v.ctx);
-        utki::scope_exit macro_context_scope_exit(
-            [this]() { this->context_stack.pop_back(); });
+      this->push_forest_frame(call.children.begin(), call.children.end(),
+                              f.evaled, false);
+      return 0;
+    }
 
-        try {
-          ctx.add("@", std::move(args));
-          // do not add in case name already exists
-          // NOLINTNEXTLINE(bugprone-empty-catch)
-        } catch (exception &) {
-          ASSERT(false)
-        }
+    // search for function
 
-        output = this->eval(*v.value);
-      } else {
-        // search for function
+    auto func = this->find_function(symbol.value());
+    if (!func) {
+      throw exception(std::string("function/macro '") + call.value.string +
+                      "' not found");
+    }
 
-        auto func_i = this->functions.find(i->value.string);
-        if (func_i == this->functions.end()) {
-          throw exception(std::string("function/macro '") + i->value.string +
-                          "' not found");
-        }
+    if (!func->pure) {
+      this->mark_impure();
+    }
+
+    auto entry = this->prof ? this->prof->get_entry(profiler::kind::function,
+                                                    call.value.string)
+                            : 0;
+
+    if (func->repeater) {
+      auto &f = this->push_frame(frame::kind::repeater_call, out);
+      f.call = &call;
+      f.output_begin = out.size();
+
+      if (this->prof) {
+        this->prof->begin(entry);
+        f.profiled = true;
+      }
 
-        ASSERT(func_i->second)
+      this->push_forest_frame(call.children.begin(), call.children.end(),
+                              f.evaled, false);
+      return 0;
+    }
+
+    // only native calls nest on the thread's stack
+    if (this->lim.max_depth != 0 && this->usage.depth == this->lim.max_depth) {
+      throw exception(std::string("call depth limit (") +
+                      std::to_string(this->lim.max_depth) + ") exceeded");
+    }
 
-        output = func_i->second(i->children);
+    ++this->usage.depth;
+    utki::scope_exit call_depth_scope_exit([this]() { --this->usage.depth; });
+
+    if (this->prof) {
+      call_profile_scope.emplace(*this->prof, entry, out);
+    }
+
+    size_t nodes_before = this->usage.nodes;
+
+    auto output = func->func(*this, call.children);
+
+    // count only the nodes created by the function itself, the ones produced
+    // by evaluation nested in the call are already counted
+    size_t nested_nodes = this->usage.nodes - nodes_before;
+    if (output.size() > nested_nodes) {
+      this->use_nodes(output.size() - nested_nodes);
+    }
+
+    if (!output.empty()) {
+      output.front().value.info.flags.set(
+          tml::flag::space, call.value.info.flags.get(tml::flag::space));
+    }
+
+    size_t output_bytes = 0;
+    if (this->prof) {
+      output_bytes = this->prof->pause([&output]() {
+        return count_bytes(output.begin(), output.end());
+      });
+      call_profile_scope->set_output_bytes(output_bytes);
+    }
 
-        if (!output.empty()) {
-          output.front().value.info.flags.set(
-              tml::flag::space, i->value.info.flags.get(tml::flag::space));
+    out.insert(out.end(), std::make_move_iterator(output.begin()),
+               std::make_move_iterator(output.end()));
+
+    return output_bytes;
+  } catch (exception &e) {
+    e.add_call(this->file_name_stack.back(), call.value);
+    throw;
+  }
+}
+
+void interpreter::expand_macro(frame &f) {
+  // the arguments are evaluated
+  f.args = std::make_shared<const tml::forest_ext>(std::move(f.evaled));
+
+  if (this->memoize) {
+    f.hash = hash_combine(std::hash<const program *>()(f.macro.get()),
+                          hash_forest(*f.args));
+
+    auto range = this->memo_cache.equal_range(f.hash);
+    for (auto i = range.first; i != range.second; ++i) {
+      const auto &e = i->second;
+      if (e.prog == f.macro && is_same(*e.args, *f.args)) {
+        if (e.if_state.has_value()) {
+          this->write_if_state() = e.if_state.value();
+        }
+        this->use_nodes(e.num_nodes);
+        f.out->insert(f.out->end(), e.output.begin(), e.output.end());
+        if (this->prof) {
+          f.out_bytes += this->prof->pause([&e]() {
+            return count_bytes(e.output.begin(), e.output.end());
+          });
         }
+        this->pop_frame();
+        return;
       }
+    }
+
+    this->memo_stack.push_back({this->if_flag_stack.size()});
+    f.memo_pushed = true;
+  }
+
+  f.context_size = this->ctx.size();
+  this->ctx.push(f.macro_scope);
+
+  try {
+    this->ctx.add(this->at_symbol, f.args);
+    // do not add in case name already exists
+    // NOLINTNEXTLINE(bugprone-empty-catch)
+  } catch (exception &) {
+    ASSERT(false)
+  }
+
+  f.expanding = true;
+  f.nodes_begin = this->usage.nodes;
+
+  // the macro scope is popped by the macro call frame
+  auto &p = this->push_frame(frame::kind::program, *f.out);
+  p.prog = f.macro.get();
+}
+
+void interpreter::finish_macro_call(frame &f) {
+  if (f.memo_pushed && !this->memo_stack.back().impure) {
+    const auto &mf = this->memo_stack.back();
+    this->add_memo_entry(
+        f.hash,
+        memo_entry{f.macro, std::move(f.args),
+                   tml::forest_ext(utki::next(f.out->begin(), f.output_begin),
+                                   f.out->end()),
+                   mf.wrote_if_state
+                       ? std::make_optional(this->if_flag_stack.back())
+                       : std::nullopt,
+                   this->usage.nodes - f.nodes_begin});
+  }
 
-      ret.insert(ret.end(), std::make_move_iterator(output.begin()),
-                 std::make_move_iterator(output.end()));
-    } catch (exception &e) {
-      throw exception(e.what(), this->file_name_stack.back(), i->value);
+  this->pop_frame();
+}
+
+void interpreter::finish_repeater_call(frame &f) {
+  this->use_nodes(1);
+
+  // the children are evaluated
+  auto &node = f.out->emplace_back(f.call->value.string);
+  node.children = std::move(f.evaled);
+
+  node.value.info.flags.set(tml::flag::space,
+                            f.call->value.info.flags.get(tml::flag::space));
+
+  f.out_bytes += node.value.string.size() + f.evaled_bytes;
+
+  this->pop_frame();
+}
+
+size_t interpreter::eval_variable(const tml::tree_ext &call,
+                                  symbol_id var_symbol, tml::forest_ext &out) {
+  ASSERT(call.children.size() == 1)
+
+  // '$' function can be shadowed by a macro
+  if (this->ctx.try_find(this->dollar_symbol).def) {
+    return this->start_call(call, this->dollar_symbol, out);
+  }
+
+  try {
+    auto v = this->ctx.try_find(var_symbol);
+    if (!v.def) {
+      throw exception(std::string("variable '") +
+                      this->symbols.name(var_symbol) + "' not found");
+    }
+
+    const auto &val = *v.def->value;
+
+    this->use_nodes(val.size());
+
+    // the output owns its nodes, so expanding a variable copies its value,
+    // only the views built by eval_view() share it
+    auto first = out.insert(out.end(), val.begin(), val.end());
+
+    if (first != out.end()) {
+      first->value.info.flags.set(tml::flag::space,
+                                  call.value.info.flags.get(tml::flag::space));
+    }
+
+    if (!this->prof) {
+      return 0;
+    }
+    return this->prof->pause(
+        [&val]() { return count_bytes(val.begin(), val.end()); });
+  } catch (exception &e) {
+    e.add_call(this->file_name_stack.back(), call.value);
+    throw;
+  }
+}
+
+bool interpreter::is_variable_call(const tml::tree_ext &tree) noexcept {
+  return tree.value.string == "$" && tree.children.size() == 1 &&
+         tree.children.front().children.empty();
+}
+
+forest_view interpreter::eval_view(const tml::forest_ext &forest) {
+  forest_view ret;
+
+  utki::scope_exit context_scope_exit(
+      [this, context_size = this->ctx.size()]() {
+        this->ctx.pop_to(context_size);
+      });
+
+  for (auto i = forest.begin(); i != forest.end();) {
+    if (i->children.empty()) {
+      auto j = std::find_if(i, forest.end(), [](const auto &n) {
+        return !n.children.empty();
+      });
+      ret.append(utki::make_span(&*i, std::distance(i, j)));
+      i = j;
+      continue;
     }
+
+    // '$' function can be shadowed by a macro
+    if (is_variable_call(*i) &&
+        !this->ctx.try_find(this->dollar_symbol).def) {
+      try {
+        ret.append(this->find_variable(i->children.front().value.string),
+                   i->value.info.flags.get(tml::flag::space));
+      } catch (exception &e) {
+        e.add_call(this->file_name_stack.back(), i->value);
+        throw;
+      }
+      ++i;
+      continue;
+    }
+
+    tml::forest_ext output;
+    this->eval_call(*i, this->symbols.find(i->value.string), output);
+    ret.append(std::move(output));
+    ++i;
   }
 
   return ret;
 }
 
-tml::forest_ext interpreter::eval() {
+std::shared_ptr<const interpreter::program>
+interpreter::compile(std::shared_ptr<const tml::forest_ext> forest) {
+  ASSERT(forest)
+
+  auto prog = std::make_shared<program>();
+
+  auto &code = prog->code;
+
+  for (auto i = forest->begin(); i != forest->end(); ++i) {
+    if (i->children.empty()) {
+      if (!code.empty() && code.back().k == program::kind::literal) {
+        code.back().end = std::next(i);
+      } else {
+        code.push_back({program::kind::literal, i, std::next(i)});
+      }
+      continue;
+    }
+
+    if (is_variable_call(*i)) {
+      code.push_back(
+          {program::kind::variable, i, std::next(i),
+           this->symbols.intern(i->children.front().value.string)});
+      continue;
+    }
+
+    code.push_back({program::kind::call, i, std::next(i),
+                    this->symbols.intern(i->value.string)});
+  }
+
+  prog->source = std::move(forest);
+
+  return prog;
+}
+
+void interpreter::eval(tml::forest_ext::const_iterator begin,
+                       tml::forest_ext::const_iterator end,
+                       const sink_type &sink, bool preserve_vars) {
+  this->start_budget();
+
+  memory_accounting::phase_scope phase_scope(memory_accounting::phase::eval);
+
+  utki::scope_exit context_scope_exit(
+      [this, context_size = this->ctx.size(), preserve_vars]() {
+        if (!preserve_vars) {
+          this->ctx.pop_to(context_size);
+        }
+      });
+
+  // reused for each top-level node to keep the allocated capacity
+  tml::forest_ext chunk;
+
+  for (auto i = begin; i != end; ++i) {
+    if (i->children.empty()) {
+      this->use_nodes(1);
+      sink(tml::tree_ext(*i));
+      continue;
+    }
+
+    this->eval_call(*i, this->symbols.find(i->value.string), chunk);
+
+    for (auto &n : chunk) {
+      sink(std::move(n));
+    }
+    chunk.clear();
+  }
+}
+
+void interpreter::eval(const sink_type &sink) {
   if (!this->file) {
     throw std::logic_error("no file interface provided");
   }
 
-  auto forest = tml::read_ext(*this->file);
+  // so that freeing the parsed file is accounted to evaluation
+  memory_accounting::phase_scope phase_scope(memory_accounting::phase::eval);
+
+  uint64_t contents_hash = 0;
+  auto forest = read_forest(*this->file, &contents_hash);
+  this->file_hashes.emplace(this->file->path(), contents_hash);
 
   this->file_name_stack.push_back(this->file->path());
   utki::scope_exit file_name_stack_scope_exit(
       [this]() { this->file_name_stack.pop_back(); });
 
-  return this->eval(forest);
+  this->eval(forest.begin(), forest.end(), sink);
+}
+
+tml::forest_ext interpreter::eval() {
+  tml::forest_ext ret;
+  this->eval([&ret](tml::tree_ext &&node) { ret.push_back(std::move(node)); });
+  return ret;
 }
 
 void interpreter::init_std_lib() {
-  const auto forest = tml::read_ext(R"qwertyuiop(
+  // The standard library is parsed and evaluated only by the first
+  // interpreter in the process. Interpreters are in the same state at this
+  // point, since all of them have registered the same built-in functions in
+  // the same order, so the others just copy the resulting symbols and
+  // definitions.
+  static const std_lib_snapshot std_lib = [this]() {
+    const auto forest = tml::read_ext(R"qwertyuiop(
 		defs{
 			// check if the first element is a parameters element
 			is_prm{asis{
@@ -655,5 +1482,21 @@ void interpreter::init_std_lib() {
 		}
 	)qwertyuiop");
 
-  this->eval(forest, true);
+    this->eval(forest, true);
+
+    return std_lib_snapshot{this->symbols, this->ctx};
+  }();
+
+  ASSERT(this->symbols.size() <= std_lib.symbols.size())
+  ASSERT([this]() {
+    for (symbol_id id = 0; id != this->symbols.size(); ++id) {
+      if (this->symbols.name(id) != std_lib.symbols.name(id)) {
+        return false;
+      }
+    }
+    return true;
+  }())
+
+  this->symbols = std_lib.symbols;
+  this->ctx = std_lib.ctx;
 }
@@ -21,53 +21,252 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
-#include <list>
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <tml/tree_ext.hpp>
 
+#include "forest_view.hpp"
+#include "include_cache.hpp"
+#include "memory_accounting.hpp"
+#include "profiler.hpp"
+#include "symbol_table.hpp"
+
 namespace curlydoc {
 
+// Thread safety: an interpreter instance must only be used by one thread at a
+// time, separate instances can be used concurrently, including the ones
+// forked from the same snapshot or sharing the same include cache.
 class interpreter {
   std::vector<std::string> file_name_stack;
 
 public:
-  using function_type = std::function<tml::forest_ext(const tml::forest_ext &)>;
+  // the interpreter which calls the function is passed as the first argument,
+  // so that functions do not need to capture it and can be shared by
+  // interpreters forked from a snapshot
+  using function_type =
+      std::function<tml::forest_ext(interpreter &, const tml::forest_ext &)>;
 
   class exception : public std::invalid_argument {
+    std::string message;
+
+    // locations of the calls the error occurred in, innermost first,
+    // the middle of a too long backtrace is skipped
+    std::vector<std::string> innermost_calls;
+    std::deque<std::string> outermost_calls;
+    size_t num_skipped_calls = 0;
+
+    // the message followed by the backtrace
+    std::string text;
+
   public:
+    // number of innermost and of outermost calls shown in the backtrace
+    constexpr static size_t max_shown_calls = 16;
+
     exception(const std::string &message);
-    exception(const std::string &message, const std::string &file,
-              const tml::leaf_ext &leaf);
+
+    // add location of the call which the error has occurred in, calls are
+    // added from the innermost to the outermost one
+    void add_call(const std::string &file, const tml::leaf_ext &leaf);
+
+    const char *what() const noexcept override;
+  };
+
+  // Limits of a single evaluation, i.e. of a call to any of eval() methods.
+  // Zero means no limit. When a limit is exceeded, evaluation is aborted
+  // with an exception which has the backtrace of macro calls and includes.
+  struct limits {
+    // Nesting depth of calls of the functions which evaluate their arguments
+    // themselves, e.g. include, for or then. Prevents stack overflow in case
+    // of endless recursion. Macro calls and repeater functions are evaluated
+    // without recursion and are not counted, so documents nested deeply by
+    // them are not limited.
+    size_t max_depth = 0;
+
+    // Number of nodes created by the evaluation, each is counted once where
+    // it is created: leaves, copies of variable values, nodes of repeater
+    // functions and the output of other functions beyond what was counted
+    // by the evaluation nested in the call. Nested nodes copied as part
+    // of another node are not counted.
+    size_t max_nodes = 0;
+
+    // number of macro invocations
+    size_t max_expansions = 0;
+
+    std::chrono::milliseconds max_time{0};
   };
 
 private:
-  std::unordered_map<std::string, function_type> functions;
+  using symbol_id = symbol_table::id_type;
+
+  // names of functions, macros and variables
+  symbol_table symbols;
+
+  const symbol_id dollar_symbol = this->symbols.intern("$");
+  const symbol_id at_symbol = this->symbols.intern("@");
+
+  struct function {
+    function_type func;
+
+    // pure function output depends only on its arguments
+    bool pure = true;
+
+    // repeater function calls are evaluated by the evaluation loop itself,
+    // see frame
+    bool repeater = false;
+  };
+
+  // indexed by symbol id, empty function means there is no function with such
+  // name
+  using function_table = std::vector<function>;
+
+  // shared with snapshots and forked interpreters, copied on write
+  std::shared_ptr<function_table> functions =
+      std::make_shared<function_table>();
 
+  const function *find_function(symbol_id id) const noexcept {
+    const auto &fs = *this->functions;
+    if (id >= fs.size() || !fs[id].func) {
+      return nullptr;
+    }
+    return &fs[id];
+  }
+
+  // compiled form of a macro definition
+  struct program {
+    enum class kind {
+      literal, // span of leaf nodes which are copied to the output as is
+      variable, // ${name} call with a literal variable name
+      call // function or macro call
+    };
+
+    struct instruction {
+      kind k;
+
+      // for literal instruction it is a span of leaf nodes,
+      // for other instructions it is a single call node
+      tml::forest_ext::const_iterator begin;
+      tml::forest_ext::const_iterator end;
+
+      // symbol of the called function/macro for call instruction,
+      // symbol of the variable name for variable instruction
+      symbol_id symbol = 0;
+    };
+
+    std::vector<instruction> code;
+
+    // instructions refer to nodes of this forest
+    std::shared_ptr<const tml::forest_ext> source;
+  };
+
+  std::shared_ptr<const program>
+  compile(std::shared_ptr<const tml::forest_ext> forest);
+
+  static bool is_variable_call(const tml::tree_ext &tree) noexcept;
+
+  // Scopes with their definitions.
+  // Scopes are created and destroyed in stack order, but the parent of a scope
+  // is not necessarily the previous scope in the stack, e.g. macro body is
+  // evaluated in a scope which is child of the scope where the macro is
+  // visible. Scopes and definitions are stored in flat arrays which keep
+  // their capacity, so pushing and popping scopes does not allocate memory.
   class context {
-    const context *const prev;
-    std::unordered_map<std::string, tml::forest_ext> defs;
+  public:
+    struct definition {
+      // definitions are immutable, so the value can be shared without copying
+      std::shared_ptr<const tml::forest_ext> value;
+
+      // compiled on first invocation of the definition as a macro
+      mutable std::shared_ptr<const program> compiled;
+
+      // file:line:offset where the definition was made, only set when
+      // profiling, to tell apart macros with the same name
+      std::shared_ptr<const std::string> site;
+    };
+
+    constexpr static size_t npos = ~size_t(0);
+
+  private:
+    struct scope {
+      size_t parent;
+
+      // index of the first scope of the contiguous chain of scopes ending
+      // with this scope, i.e. all scopes in range [base, this] are
+      // ancestors of this scope
+      size_t base;
+
+      // index of the first definition of this scope
+      size_t defs_begin;
+    };
+
+    std::vector<scope> scopes;
+
+    struct binding {
+      symbol_id name;
+      size_t scope;
+
+      // previous definition with the same name, npos if none
+      size_t shadowed;
+
+      definition def;
+    };
+
+    std::vector<binding> defs;
+
+    // indexed by symbol id, index of the latest definition with the name
+    std::vector<size_t> latest;
+
+    bool is_visible(size_t scope, size_t from) const noexcept;
 
   public:
-    context(const context *const prev = nullptr) : prev(prev) {}
+    context();
+
+    size_t size() const noexcept { return this->scopes.size(); }
+
+    size_t top() const noexcept { return this->scopes.size() - 1; }
+
+    void push(size_t parent);
 
-    void add(const std::string &name, tml::forest_ext &&value);
+    void push() { this->push(this->top()); }
+
+    void pop() noexcept { this->pop_to(this->top()); }
+
+    // pop scopes until there are only given number of scopes left
+    void pop_to(size_t size) noexcept;
+
+    // add definition to the top scope
+    void add(symbol_id name, std::shared_ptr<const tml::forest_ext> value,
+             std::shared_ptr<const std::string> site = nullptr);
 
     struct find_result {
-      const tml::forest_ext *value;
-      const context &ctx;
+      const definition *def;
+
+      // parent of the scope where the definition was found
+      size_t scope;
     };
 
-    find_result try_find(const std::string &name) const;
+    // find definition visible from the top scope
+    find_result try_find(symbol_id name) const noexcept;
 
-    const tml::forest_ext &find(const std::string &name) const;
+    template <typename func_type>
+    void for_each_definition(func_type &&func) const {
+      for (const auto &b : this->defs) {
+        func(b.def);
+      }
+    }
   };
 
-  // NOTE: use std::list to avoid context objects to be moved
-  std::list<context> context_stack = {context()};
+  context ctx;
 
-  context &push_context(const context *prev = nullptr);
+  void add_definition(const std::string &name, tml::forest_ext &&value,
+                      std::shared_ptr<const std::string> site = nullptr);
+
+  const std::shared_ptr<const tml::forest_ext> &
+  find_variable(const std::string &name) const;
 
   struct bool_state {
     bool flag = false;
@@ -93,11 +292,221 @@ private:
     ~if_flag_push() { this->owner.if_flag_stack.pop_back(); }
   };
 
+  // accessing boolean flag of the current scope
+  bool_state &read_if_state();
+  bool_state &write_if_state();
+
+  limits lim;
+
+  // usage of the limits by the current evaluation
+  struct budget {
+    // nesting of native function calls
+    size_t depth = 0;
+    size_t nodes = 0;
+    size_t expansions = 0;
+
+    // the clock is only checked every few calls
+    size_t calls = 0;
+
+    std::chrono::steady_clock::time_point deadline;
+  } usage;
+
+  // start new evaluation, unless it is nested in another one
+  void start_budget();
+
+  // account for the nodes added to the output
+  void use_nodes(size_t num_nodes) {
+    this->usage.nodes += num_nodes;
+    if (this->lim.max_nodes != 0 && this->usage.nodes > this->lim.max_nodes) {
+      this->throw_nodes_limit_exceeded();
+    }
+  }
+
+  [[noreturn]] void throw_nodes_limit_exceeded() const;
+
+  // check the time limit before entering a function or macro call
+  void check_call();
+
+  // memoization of macro invocations
+
+  bool memoize = false;
+
+  // state of the macro invocation being evaluated with memoization enabled
+  struct memo_frame {
+    // size of if_flag_stack at the moment of invocation
+    size_t if_depth;
+
+    // the macro has changed boolean flag of its caller's scope
+    bool wrote_if_state = false;
+
+    // the macro output depends on something else than its arguments
+    bool impure = false;
+  };
+
+  std::vector<memo_frame> memo_stack;
+
+  void mark_impure() noexcept;
+
+  struct memo_entry {
+    std::shared_ptr<const program> prog;
+    std::shared_ptr<const tml::forest_ext> args;
+    tml::forest_ext output;
+
+    // final boolean flag of the caller's scope, if the macro changed it
+    std::optional<bool_state> if_state;
+
+    // nodes counted by the evaluation of the program, a cache hit uses
+    // the same amount of the node limit
+    size_t num_nodes = 0;
+  };
+
+  // key is the hash of the program and the arguments
+  std::unordered_multimap<size_t, memo_entry> memo_cache;
+
+  // approximate memory held by the cache entries
+  size_t memo_cache_size = 0;
+
+  size_t max_memo_cache_size = default_max_memo_cache_size;
+
+  void add_memo_entry(size_t hash, memo_entry &&e);
+
   std::unique_ptr<papki::file> file; // for including files
 
+  std::shared_ptr<include_cache> included_files =
+      std::make_shared<include_cache>();
+
+  // paths of all files included so far, in order of first inclusion
+  std::vector<std::string> included_file_names;
+  std::unordered_set<std::string> included_file_name_set;
+
+  // hashes of contents of the evaluated and included files, by path
+  std::unordered_map<std::string, uint64_t> file_hashes;
+
+  // null when profiling is off
+  std::shared_ptr<profiler> prof;
+
+  // Frame of the evaluation stack.
+  // Macro calls and repeater function calls, which deeply nested documents
+  // consist of, are evaluated by a loop over the heap allocated frames instead
+  // of recursion, so the nesting depth is not limited by the thread's stack.
+  // Other functions are called natively and their arguments are evaluated by
+  // a nested run of the loop.
+  struct frame {
+    enum class kind {
+      // evaluating nodes of a forest
+      forest,
+      // evaluating instructions of a macro program
+      program,
+      // evaluating arguments of a macro call, then its program
+      macro_call,
+      // evaluating children of a repeater function call
+      repeater_call
+    };
+
+    kind k = kind::forest;
+
+    // the frame output is appended to this forest
+    tml::forest_ext *out = nullptr;
+
+    // context size to restore when the frame is done, npos to keep
+    // the definitions
+    size_t context_size = context::npos;
+
+    // forest frame: nodes left to evaluate
+    tml::forest_ext::const_iterator begin;
+    tml::forest_ext::const_iterator end;
+
+    // program frame
+    const program *prog = nullptr;
+    size_t next_instruction = 0;
+
+    // call frames
+    const tml::tree_ext *call = nullptr;
+    size_t output_begin = 0; // where the call output starts in the output
+    bool profiled = false;
+
+    // When profiling, size of strings appended to the output by this frame
+    // and by the finished frames above it. Counting the output as it is
+    // produced avoids walking the output of each nested call again.
+    size_t out_bytes = 0;
+
+    // when profiling, size of strings of the evaled forest
+    size_t evaled_bytes = 0;
+
+    // arguments of a macro call or children of a repeater function call
+    tml::forest_ext evaled;
+
+    // macro call frame
+    std::shared_ptr<const program> macro;
+    size_t macro_scope = 0;
+    bool expanding = false; // arguments are evaluated, the program is running
+    std::shared_ptr<const tml::forest_ext> args;
+    size_t hash = 0;
+    bool memo_pushed = false;
+    size_t nodes_begin = 0; // node limit usage when the program started
+  };
+
+  // frames are kept allocated for reuse, only first num_frames are in use
+  std::vector<std::unique_ptr<frame>> frames;
+  size_t num_frames = 0;
+
+  frame &push_frame(frame::kind k, tml::forest_ext &out);
+
+  void push_forest_frame(tml::forest_ext::const_iterator begin,
+                         tml::forest_ext::const_iterator end,
+                         tml::forest_ext &out, bool preserve_vars);
+
+  // undo the frame's changes to the interpreter state and remove the frame
+  void pop_frame() noexcept;
+
+  // evaluate until the stack is back to the given number of frames
+  void run(size_t base);
+
+  // Start evaluation of the call, either pushing frames or calling
+  // a function. When profiling, returns size of strings of the nodes appended
+  // to the output by a function call, 0 otherwise.
+  size_t start_call(const tml::tree_ext &call,
+                    std::optional<symbol_id> symbol, tml::forest_ext &out);
+
+  void expand_macro(frame &f);
+
+  void finish_macro_call(frame &f);
+
+  void finish_repeater_call(frame &f);
+
 public:
   interpreter(std::unique_ptr<papki::file> file);
 
+  // State of an interpreter captured between evaluations: functions,
+  // definitions made at the root level and settings. Snapshot is immutable,
+  // so interpreters can be forked from the same snapshot concurrently.
+  class snapshot {
+    friend class interpreter;
+
+    symbol_table symbols;
+    std::shared_ptr<function_table> functions;
+    context ctx;
+    bool_state if_state;
+    bool memoize;
+    size_t max_memo_cache_size;
+    limits lim;
+    std::shared_ptr<include_cache> included_files;
+
+    snapshot(interpreter &owner);
+  };
+
+  // Capture current state, e.g. after adding functions and evaluating
+  // common definitions with preserve_vars set to true.
+  // All definitions are compiled, so that forked interpreters share the
+  // compiled macros.
+  snapshot make_snapshot();
+
+  // Fork interpreter from the snapshot.
+  // Function table and definition values are shared with the snapshot,
+  // the function table is copied if a function is added to the forked
+  // interpreter.
+  interpreter(const snapshot &snap, std::unique_ptr<papki::file> file);
+
   interpreter(const interpreter &) = delete;
   interpreter &operator=(const interpreter &) = delete;
 
@@ -108,7 +517,12 @@ public:
 
   tml::forest_ext eval(tml::forest_ext::const_iterator begin,
                        tml::forest_ext::const_iterator end,
-                       bool preserve_vars = false);
+                       bool preserve_vars = false) {
+    memory_accounting::phase_scope phase_scope(memory_accounting::phase::eval);
+    tml::forest_ext ret;
+    this->eval_to(begin, end, ret, preserve_vars);
+    return ret;
+  }
 
   tml::forest_ext eval(const tml::forest_ext &forest,
                        bool preserve_vars = false) {
@@ -117,13 +531,113 @@ public:
 
   tml::forest_ext eval();
 
-  void add_function(const std::string &name, function_type &&func);
+  // receives evaluated top-level nodes one by one
+  using sink_type = std::function<void(tml::tree_ext &&)>;
+
+  // Evaluate passing each top-level node of the result to the sink as soon
+  // as it is ready. Only the output of one top-level input node is held in
+  // memory at a time.
+  void eval(tml::forest_ext::const_iterator begin,
+            tml::forest_ext::const_iterator end, const sink_type &sink,
+            bool preserve_vars = false);
+
+  // evaluate the file, passing the result to the sink node by node
+  void eval(const sink_type &sink);
+
+private:
+  // evaluation results are appended to the given output forest,
+  // this avoids creating temporary forests on each level of evaluation
+  void eval_to(tml::forest_ext::const_iterator begin,
+               tml::forest_ext::const_iterator end, tml::forest_ext &out,
+               bool preserve_vars = false);
+
+  void eval_call(const tml::tree_ext &call, std::optional<symbol_id> symbol,
+                 tml::forest_ext &out);
+
+  // when profiling, returns size of strings of the variable value appended
+  // to the output, 0 otherwise
+  size_t eval_variable(const tml::tree_ext &call, symbol_id var_symbol,
+                       tml::forest_ext &out);
+
+  // evaluate forest, variable values are referred to instead of being copied
+  forest_view eval_view(const tml::forest_ext &forest);
+
+public:
+  // pure function is the one which output depends only on its arguments,
+  // macros calling impure functions are not memoized
+  void add_function(const std::string &name, function_type &&func,
+                    bool pure = true);
 
   void add_repeater_function(const std::string &name);
 
   void add_repeater_functions(utki::span<const std::string> names);
 
+  // Enable/disable caching of macro invocation results.
+  // When enabled, output of macro invocation is cached by the macro definition
+  // and the evaluated macro arguments, and repeated invocations with the same
+  // arguments reuse the cached output. Since macro definitions are immutable
+  // and the macro body only sees definitions visible at the point of the
+  // macro definition, the output depends only on the arguments, except for
+  // the following cases which are detected and not cached:
+  // - the macro calls an impure function, e.g. 'include';
+  // - the macro reads boolean flag of its caller's scope, e.g. calls 'then'
+  //   without 'if'.
+  // Disabling memoization clears the cache.
+  void enable_memoization(bool enable = true);
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+  constexpr static size_t default_max_memo_cache_size = 64 * 1024 * 1024;
+
+  // Set approximate limit of memory held by the memoization cache, in bytes.
+  // The cache is cleared when adding an entry would exceed the limit,
+  // outputs larger than the limit are not cached.
+  void set_max_memo_cache_size(size_t size) noexcept {
+    this->max_memo_cache_size = size;
+  }
+
+  // approximate memory held by the memoization cache, in bytes
+  size_t get_memo_cache_size() const noexcept {
+    return this->memo_cache_size;
+  }
+
+  void set_limits(const limits &lim) noexcept { this->lim = lim; }
+
+  // Set cache of parsed included files.
+  // By default each interpreter has its own cache, setting the same cache
+  // to several interpreters makes each included file parsed only once.
+  void set_include_cache(std::shared_ptr<include_cache> cache);
+
+  // Set profiler to record calls of functions, macros and included files,
+  // nullptr turns profiling off. Profiling is off by default.
+  // Macros defined while profiling is on are reported separately for each
+  // definition site, others are reported by name only.
+  void set_profiler(std::shared_ptr<profiler> prof) {
+    this->prof = std::move(prof);
+  }
+
+  // Get paths of the files included by 'include' function so far, including
+  // nested inclusions, e.g. to track dependencies of the evaluated document.
+  const std::vector<std::string> &get_included_file_names() const noexcept {
+    return this->included_file_names;
+  }
+
+  // Get hashes of contents of the evaluated file and the included files, by
+  // path, see hash_contents(). The hash is of the contents which were
+  // evaluated, even if the file has changed since. Files which could not be
+  // read have no hash.
+  const std::unordered_map<std::string, uint64_t> &
+  get_file_hashes() const noexcept {
+    return this->file_hashes;
+  }
+
 private:
+  // state of a freshly constructed interpreter after evaluating the standard
+  // library
+  struct std_lib_snapshot {
+    symbol_table symbols;
+    context ctx;
+  };
+
   void init_std_lib();
 };
 
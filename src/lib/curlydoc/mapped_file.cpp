@@ -0,0 +1,122 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "mapped_file.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utki/util.hpp>
+
+using namespace curlydoc;
+
+namespace {
+std::atomic<bool> file_mapping_enabled{true};
+} // namespace
+
+void curlydoc::enable_file_mapping(bool enable) noexcept {
+  file_mapping_enabled.store(enable, std::memory_order_relaxed);
+}
+
+mapped_file::mapped_file(const std::string &file_name) {
+  int fd = ::open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            std::string("could not open file: ") + file_name);
+  }
+
+  utki::scope_exit fd_scope_exit([fd]() { ::close(fd); });
+
+  struct stat st {};
+  if (::fstat(fd, &st) != 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            std::string("could not stat file: ") + file_name);
+  }
+
+  if (!file_mapping_enabled.load(std::memory_order_relaxed)) {
+    this->read(fd, size_t(st.st_size), file_name);
+    return;
+  }
+
+  // zero length mappings are not allowed, empty file is just an empty span
+  if (st.st_size == 0) {
+    return;
+  }
+
+  void *addr =
+      ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    throw std::system_error(errno, std::generic_category(),
+                            std::string("could not map file: ") + file_name);
+  }
+
+  this->addr = addr;
+  this->size = size_t(st.st_size);
+  this->mapped = true;
+
+  // the files are parsed from the beginning to the end, so let the kernel
+  // read ahead and drop the pages behind
+  ::madvise(this->addr, this->size, MADV_SEQUENTIAL);
+}
+
+void mapped_file::read(int fd, size_t size_hint,
+                       const std::string &file_name) {
+  // the file size can change while it is read, so read till the end of file
+  this->buffer.resize(size_hint + 1);
+
+  size_t num_read = 0;
+  for (;;) {
+    if (num_read == this->buffer.size()) {
+      this->buffer.resize(this->buffer.size() * 2);
+    }
+
+    ssize_t res = ::read(fd, this->buffer.data() + num_read,
+                         this->buffer.size() - num_read);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(),
+                              std::string("could not read file: ") +
+                                  file_name);
+    }
+    if (res == 0) {
+      break;
+    }
+    num_read += size_t(res);
+  }
+
+  this->buffer.resize(num_read);
+  this->addr = this->buffer.data();
+  this->size = this->buffer.size();
+}
+
+mapped_file::~mapped_file() {
+  if (this->mapped) {
+    ::munmap(this->addr, this->size);
+  }
+}
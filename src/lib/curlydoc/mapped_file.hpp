@@ -0,0 +1,72 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <utki/span.hpp>
+
+namespace curlydoc {
+
+// Read-only memory mapping of a whole file.
+// When file mapping is disabled, the file is read into memory instead.
+class mapped_file {
+  void *addr = nullptr;
+  size_t size = 0;
+
+  bool mapped = false;
+  std::vector<uint8_t> buffer;
+
+  void read(int fd, size_t size_hint, const std::string &file_name);
+
+public:
+  // Throws std::system_error on failure.
+  explicit mapped_file(const std::string &file_name);
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  mapped_file(mapped_file &&) = delete;
+  mapped_file &operator=(mapped_file &&) = delete;
+
+  ~mapped_file();
+
+  utki::span<const uint8_t> data() const noexcept {
+    return utki::make_span(static_cast<const uint8_t *>(this->addr),
+                           this->size);
+  }
+
+  std::string_view str() const noexcept {
+    return std::string_view(static_cast<const char *>(this->addr), this->size);
+  }
+};
+
+// Enable or disable memory mapping of files, it is enabled by default.
+// Accessing a mapped page beyond the end of the file raises SIGBUS, so files
+// which can be truncated while they are read, e.g. edited while being watched
+// for changes, must not be mapped. Not to be called while files are read.
+void enable_file_mapping(bool enable) noexcept;
+
+} // namespace curlydoc
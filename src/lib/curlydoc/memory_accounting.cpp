@@ -0,0 +1,79 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "memory_accounting.hpp"
+
+#include <algorithm>
+
+using namespace curlydoc;
+
+namespace {
+thread_local memory_accounting::thread_stats stats;
+thread_local memory_accounting::phase current_phase =
+    memory_accounting::phase::other;
+} // namespace
+
+const memory_accounting::thread_stats &memory_accounting::get() noexcept {
+  return stats;
+}
+
+void memory_accounting::reset() noexcept { stats = thread_stats(); }
+
+void memory_accounting::allocated(size_t size) noexcept {
+  stats.current_bytes += ptrdiff_t(size);
+  stats.peak_bytes = std::max(stats.peak_bytes, stats.current_bytes);
+
+  auto &p = stats.phases[size_t(current_phase)];
+  p.net_bytes += ptrdiff_t(size);
+  p.allocated_bytes += size;
+  ++p.num_allocations;
+  p.peak_bytes = std::max(p.peak_bytes, stats.current_bytes);
+}
+
+void memory_accounting::freed(size_t size) noexcept {
+  stats.current_bytes -= ptrdiff_t(size);
+  stats.phases[size_t(current_phase)].net_bytes -= ptrdiff_t(size);
+}
+
+const char *memory_accounting::to_string(phase p) noexcept {
+  switch (p) {
+  case phase::other:
+    return "other";
+  case phase::parse:
+    return "parse";
+  case phase::eval:
+    return "eval";
+  case phase::translate:
+    return "translate";
+  case phase::emit:
+    return "emit";
+  case phase::enum_size:
+    break;
+  }
+  return "";
+}
+
+memory_accounting::phase_scope::phase_scope(phase p) noexcept
+    : prev(current_phase) {
+  current_phase = p;
+}
+
+memory_accounting::phase_scope::~phase_scope() { current_phase = this->prev; }
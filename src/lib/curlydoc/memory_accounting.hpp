@@ -0,0 +1,91 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace curlydoc {
+
+// Memory usage by phases of document processing, per thread.
+// The library marks the phases it goes through, while counting is up to the
+// application: it can replace global operator new and delete and report
+// each allocation and deallocation with allocated() and freed(). Memory
+// freed in a phase is accounted to that phase, regardless of which phase
+// allocated it.
+class memory_accounting {
+public:
+  enum class phase : uint8_t { other, parse, eval, translate, emit, enum_size };
+
+  struct phase_stats {
+    // bytes allocated minus bytes freed during the phase, negative if the
+    // phase freed more than it allocated, e.g. memory of the other phases
+    ptrdiff_t net_bytes = 0;
+
+    size_t allocated_bytes = 0;
+    size_t num_allocations = 0;
+
+    // maximum of the thread's bytes in use while in the phase
+    ptrdiff_t peak_bytes = 0;
+  };
+
+  struct thread_stats {
+    // relative to the last reset(), can be negative if memory allocated
+    // before is freed
+    ptrdiff_t current_bytes = 0;
+    ptrdiff_t peak_bytes = 0;
+
+    std::array<phase_stats, size_t(phase::enum_size)> phases{};
+  };
+
+  // statistics of the calling thread
+  static const thread_stats &get() noexcept;
+
+  // start counting from zero in the calling thread
+  static void reset() noexcept;
+
+  static void allocated(size_t size) noexcept;
+  static void freed(size_t size) noexcept;
+
+  static const char *to_string(phase p) noexcept;
+
+  // Marks the calling thread being in the given phase for the lifetime of
+  // the object. Phases can be nested, e.g. included files are parsed during
+  // evaluation.
+  class phase_scope {
+    phase prev;
+
+  public:
+    explicit phase_scope(phase p) noexcept;
+
+    phase_scope(const phase_scope &) = delete;
+    phase_scope &operator=(const phase_scope &) = delete;
+
+    phase_scope(phase_scope &&) = delete;
+    phase_scope &operator=(phase_scope &&) = delete;
+
+    ~phase_scope();
+  };
+};
+
+} // namespace curlydoc
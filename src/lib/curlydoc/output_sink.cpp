@@ -0,0 +1,137 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "output_sink.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <utki/debug.hpp>
+
+using namespace curlydoc;
+
+fd_sink::fd_sink(const std::string &file_name)
+    : fd(::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+                0644)),
+      close_fd(true) {
+  if (this->fd < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            std::string("could not open file: ") + file_name);
+  }
+}
+
+fd_sink::~fd_sink() {
+  try {
+    this->flush();
+    // NOLINTNEXTLINE(bugprone-empty-catch)
+  } catch (std::exception &) {
+    // destructor must not throw, call flush() explicitly to handle errors
+  }
+
+  if (this->close_fd) {
+    ::close(this->fd);
+  }
+}
+
+void fd_sink::write(std::string_view data) {
+  memory_accounting::phase_scope phase_scope(memory_accounting::phase::emit);
+
+  if (data.size() >= chunk_size) {
+    this->write_out(data);
+    return;
+  }
+
+  while (!data.empty()) {
+    if (this->last_chunk_fill == chunk_size) {
+      if (this->num_used_chunks == max_num_chunks) {
+        this->write_out(std::string_view());
+      }
+      if (this->num_used_chunks == this->chunks.size()) {
+        this->chunks.push_back(std::make_unique<char[]>(chunk_size));
+      }
+      ++this->num_used_chunks;
+      this->last_chunk_fill = 0;
+    }
+
+    ASSERT(this->num_used_chunks != 0)
+    size_t n = std::min(data.size(), chunk_size - this->last_chunk_fill);
+    std::memcpy(this->chunks[this->num_used_chunks - 1].get() +
+                    this->last_chunk_fill,
+                data.data(), n);
+    this->last_chunk_fill += n;
+    data = data.substr(n);
+  }
+}
+
+void fd_sink::write_out(std::string_view extra_data) {
+  std::array<iovec, max_num_chunks + 1> iov{};
+  size_t num_iov = 0;
+
+  for (size_t i = 0; i != this->num_used_chunks; ++i) {
+    iov[num_iov].iov_base = this->chunks[i].get();
+    iov[num_iov].iov_len =
+        i + 1 == this->num_used_chunks ? this->last_chunk_fill : chunk_size;
+    ++num_iov;
+  }
+
+  if (!extra_data.empty()) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    iov[num_iov].iov_base = const_cast<char *>(extra_data.data());
+    iov[num_iov].iov_len = extra_data.size();
+    ++num_iov;
+  }
+
+  this->num_used_chunks = 0;
+  this->last_chunk_fill = chunk_size;
+
+  // writev() can write less than requested, so repeat until everything is
+  // written
+  iovec *cur = iov.data();
+  while (num_iov != 0) {
+    auto res = ::writev(this->fd, cur, int(num_iov));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(),
+                              "writev() failed");
+    }
+
+    auto written = size_t(res);
+    while (num_iov != 0 && written >= cur->iov_len) {
+      written -= cur->iov_len;
+      ++cur;
+      --num_iov;
+    }
+    if (num_iov != 0) {
+      cur->iov_base = static_cast<char *>(cur->iov_base) + written;
+      cur->iov_len -= written;
+    }
+  }
+}
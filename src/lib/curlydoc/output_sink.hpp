@@ -0,0 +1,112 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "memory_accounting.hpp"
+
+namespace curlydoc {
+
+// Destination of the translated document.
+class output_sink {
+public:
+  output_sink() = default;
+
+  output_sink(const output_sink &) = delete;
+  output_sink &operator=(const output_sink &) = delete;
+
+  output_sink(output_sink &&) = delete;
+  output_sink &operator=(output_sink &&) = delete;
+
+  virtual ~output_sink() = default;
+
+  virtual void write(std::string_view data) = 0;
+
+  // write out buffered data, if any
+  virtual void flush() {}
+
+  output_sink &operator<<(std::string_view data) {
+    this->write(data);
+    return *this;
+  }
+
+  output_sink &operator<<(char c) {
+    this->write(std::string_view(&c, 1));
+    return *this;
+  }
+};
+
+// Collects output in memory.
+class memory_sink : public output_sink {
+  std::string buffer;
+
+public:
+  void write(std::string_view data) override {
+    memory_accounting::phase_scope phase_scope(memory_accounting::phase::emit);
+    this->buffer.append(data);
+  }
+
+  const std::string &str() const noexcept { return this->buffer; }
+
+  void clear() noexcept { this->buffer.clear(); }
+};
+
+// Writes output to a file descriptor.
+// Small writes are collected into fixed size chunks which are written out
+// with a single writev() call once all the chunks are full. Writes larger
+// than a chunk are not copied, but passed to writev() along with the chunks.
+// Chunks are allocated once and reused.
+class fd_sink : public output_sink {
+  int fd;
+  bool close_fd;
+
+  constexpr static size_t chunk_size = 0x10000; // 64 kB
+  constexpr static size_t max_num_chunks = 16;
+
+  std::vector<std::unique_ptr<char[]>> chunks;
+
+  // number of chunks in use, the last one can be partially filled
+  size_t num_used_chunks = 0;
+  size_t last_chunk_fill = chunk_size;
+
+  void write_out(std::string_view extra_data);
+
+public:
+  // If close_fd is true the file descriptor is closed on destruction.
+  fd_sink(int fd, bool close_fd = false) : fd(fd), close_fd(close_fd) {}
+
+  // Open file for writing, truncating it if it exists.
+  // Throws std::system_error on failure.
+  fd_sink(const std::string &file_name);
+
+  ~fd_sink() override;
+
+  void write(std::string_view data) override;
+
+  void flush() override { this->write_out(std::string_view()); }
+};
+
+} // namespace curlydoc
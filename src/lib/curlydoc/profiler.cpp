@@ -0,0 +1,234 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+#include <utki/debug.hpp>
+
+using namespace curlydoc;
+
+size_t profiler::get_entry(kind k, std::string_view name,
+                           std::string_view site) {
+  this->key.clear();
+  this->key.push_back(char(k));
+  this->key.append(name);
+  this->key.push_back('\0');
+  this->key.append(site);
+
+  auto i = this->index.find(this->key);
+  if (i != this->index.end()) {
+    return i->second;
+  }
+
+  this->entries.push_back({k, std::string(name), std::string(site)});
+  this->index.insert(std::make_pair(this->key, this->entries.size() - 1));
+
+  return this->entries.size() - 1;
+}
+
+void profiler::begin(size_t entry) {
+  ASSERT(entry < this->entries.size())
+  this->frames.push_back({entry, this->now()});
+}
+
+void profiler::end(size_t output_bytes) {
+  ASSERT(!this->frames.empty())
+
+  auto duration = this->now() - this->frames.back().start;
+
+  const auto &f = this->frames.back();
+  auto &e = this->entries[f.entry];
+
+  ++e.calls;
+  e.inclusive_time += duration;
+  e.exclusive_time += duration - f.children_time;
+  e.output_bytes += output_bytes;
+
+  if (this->record_trace) {
+    this->events.push_back({f.entry, f.start, duration, 0});
+  }
+
+  this->frames.pop_back();
+
+  if (!this->frames.empty()) {
+    this->frames.back().children_time += duration;
+  }
+}
+
+void profiler::merge(const profiler &other, std::string_view track_name) {
+  std::vector<size_t> entry_map;
+  entry_map.reserve(other.entries.size());
+
+  for (const auto &oe : other.entries) {
+    auto i = this->get_entry(oe.kind, oe.name, oe.site);
+    auto &e = this->entries[i];
+    e.calls += oe.calls;
+    e.inclusive_time += oe.inclusive_time;
+    e.exclusive_time += oe.exclusive_time;
+    e.output_bytes += oe.output_bytes;
+    entry_map.push_back(i);
+  }
+
+  size_t first_track = this->track_names.size();
+  for (size_t t = 0; t != other.track_names.size(); ++t) {
+    this->track_names.push_back(t == 0 ? std::string(track_name)
+                                       : other.track_names[t]);
+  }
+
+  for (const auto &ev : other.events) {
+    this->events.push_back(
+        {entry_map[ev.entry], ev.start, ev.duration, first_track + ev.track});
+  }
+}
+
+namespace {
+const char *kind_to_string(profiler::kind k) {
+  switch (k) {
+  case profiler::kind::function:
+    return "function";
+  case profiler::kind::macro:
+    return "macro";
+  case profiler::kind::include:
+    return "include";
+  }
+  return "";
+}
+
+double to_ms(profiler::clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+} // namespace
+
+void profiler::write_report(std::ostream &o) const {
+  std::vector<const entry *> sorted;
+  sorted.reserve(this->entries.size());
+  for (const auto &e : this->entries) {
+    sorted.push_back(&e);
+  }
+
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    return a->exclusive_time > b->exclusive_time;
+  });
+
+  auto flags = o.flags();
+  auto precision = o.precision();
+
+  o << std::setw(10) << "calls" << std::setw(14) << "incl. ms"
+    << std::setw(14) << "excl. ms" << std::setw(14) << "output bytes"
+    << "  " << std::left << std::setw(10) << "kind" << "name" << std::right
+    << '\n';
+
+  o << std::fixed << std::setprecision(3);
+
+  for (const auto *e : sorted) {
+    o << std::setw(10) << e->calls << std::setw(14) << to_ms(e->inclusive_time)
+      << std::setw(14) << to_ms(e->exclusive_time) << std::setw(14)
+      << e->output_bytes << "  " << std::left << std::setw(10)
+      << kind_to_string(e->kind) << e->name << std::right;
+    if (!e->site.empty()) {
+      o << " (" << e->site << ")";
+    }
+    o << '\n';
+  }
+
+  o.flags(flags);
+  o.precision(precision);
+}
+
+namespace {
+void write_json_string(std::ostream &o, std::string_view str) {
+  o << '"';
+  for (char c : str) {
+    switch (c) {
+    case '"':
+      o << "\\\"";
+      break;
+    case '\\':
+      o << "\\\\";
+      break;
+    default:
+      // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers)
+      if (static_cast<unsigned char>(c) < 0x20) {
+        o << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << unsigned(c) << std::dec << std::setfill(' ');
+      } else {
+        o << c;
+      }
+      break;
+    }
+  }
+  o << '"';
+}
+
+double to_us(profiler::clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+} // namespace
+
+void profiler::write_trace(std::ostream &o) const {
+  auto flags = o.flags();
+  auto precision = o.precision();
+
+  o << std::fixed << std::setprecision(3);
+
+  o << "{\"traceEvents\":[";
+
+  bool first = true;
+  auto separate = [&]() {
+    o << (first ? "\n" : ",\n");
+    first = false;
+  };
+
+  for (size_t t = 0; t != this->track_names.size(); ++t) {
+    if (this->track_names[t].empty()) {
+      continue;
+    }
+    separate();
+    o << R"({"name":"thread_name","ph":"M","pid":0,"tid":)" << t
+      << R"(,"args":{"name":)";
+    write_json_string(o, this->track_names[t]);
+    o << "}}";
+  }
+
+  for (const auto &ev : this->events) {
+    const auto &e = this->entries[ev.entry];
+    separate();
+    o << R"({"name":)";
+    write_json_string(o, e.name);
+    o << R"(,"cat":")" << kind_to_string(e.kind) << R"(","ph":"X","ts":)"
+      << to_us(ev.start.time_since_epoch()) << R"(,"dur":)"
+      << to_us(ev.duration) << R"(,"pid":0,"tid":)" << ev.track;
+    if (!e.site.empty()) {
+      o << R"(,"args":{"site":)";
+      write_json_string(o, e.site);
+      o << "}";
+    }
+    o << "}";
+  }
+
+  o << "\n]}\n";
+
+  o.flags(flags);
+  o.precision(precision);
+}
@@ -0,0 +1,142 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace curlydoc {
+
+// Collects call counts, times and output sizes of functions, macros and
+// included files evaluated by an interpreter.
+// Not thread-safe, each interpreter needs its own profiler, profilers can
+// be merged afterwards.
+class profiler {
+public:
+  using clock = std::chrono::steady_clock;
+
+  enum class kind { function, macro, include };
+
+  struct entry {
+    profiler::kind kind;
+
+    std::string name;
+
+    // definition site of a macro as file:line:offset, empty for others
+    std::string site;
+
+    size_t calls = 0;
+
+    // time spent in the calls, including nested calls
+    clock::duration inclusive_time{};
+
+    // time spent in the calls, excluding nested profiled calls
+    clock::duration exclusive_time{};
+
+    // total size of strings of the produced nodes
+    size_t output_bytes = 0;
+  };
+
+private:
+  std::vector<entry> entries;
+
+  // key is kind, name and site
+  std::unordered_map<std::string, size_t> index;
+
+  // reused for making keys to avoid allocating memory for each lookup
+  std::string key;
+
+  struct frame {
+    size_t entry;
+    clock::time_point start;
+    clock::duration children_time{};
+  };
+
+  std::vector<frame> frames;
+
+  // time the clock was paused for counting output sizes, call times are
+  // measured on the clock minus this time
+  clock::duration paused{};
+
+  clock::time_point now() const noexcept { return clock::now() - this->paused; }
+
+  bool record_trace;
+
+  struct event {
+    size_t entry;
+    clock::time_point start;
+    clock::duration duration;
+
+    // row of the trace, there is one for each merged profiler
+    size_t track;
+  };
+
+  std::vector<event> events;
+
+  std::vector<std::string> track_names = {std::string()};
+
+public:
+  // If record_trace is true, each call is recorded for write_trace(),
+  // otherwise only totals are collected.
+  explicit profiler(bool record_trace = false)
+      : record_trace(record_trace) {}
+
+  // get index of the entry, the entry is added if it does not exist yet
+  size_t get_entry(kind k, std::string_view name, std::string_view site = {});
+
+  // Calls must be nested, i.e. end() finishes the call started by the last
+  // begin().
+  void begin(size_t entry);
+  void end(size_t output_bytes);
+
+  // Call the function with the clock paused, so that profiling overhead,
+  // e.g. counting output sizes, is not charged to the calls being profiled.
+  template <typename func_type>
+  auto pause(func_type &&func) {
+    auto stop = clock::now();
+    auto ret = func();
+    this->paused += clock::now() - stop;
+    return ret;
+  }
+
+  const std::vector<entry> &get_entries() const noexcept {
+    return this->entries;
+  }
+
+  // Add entries of other profiler to this one.
+  // Recorded calls of the other profiler are put to a separate trace row
+  // with the given name.
+  void merge(const profiler &other, std::string_view track_name);
+
+  // Write table of entries sorted by exclusive time.
+  void write_report(std::ostream &o) const;
+
+  // Write recorded calls in Chrome trace event format, which can be viewed
+  // with chrome://tracing or https://ui.perfetto.dev.
+  void write_trace(std::ostream &o) const;
+};
+
+} // namespace curlydoc
@@ -0,0 +1,41 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#include "symbol_table.hpp"
+
+using namespace curlydoc;
+
+symbol_table::id_type symbol_table::intern(const std::string &name) {
+  auto i = this->ids.insert(std::make_pair(name, id_type(this->names.size())));
+  if (i.second) {
+    this->names.push_back(name);
+  }
+  return i.first->second;
+}
+
+std::optional<symbol_table::id_type>
+symbol_table::find(const std::string &name) const noexcept {
+  auto i = this->ids.find(name);
+  if (i == this->ids.end()) {
+    return {};
+  }
+  return i->second;
+}
@@ -0,0 +1,57 @@
+/*
+curlydoc - document markup language translator
+
+Copyright (C) 2021 Ivan Gagis <igagis@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* ================ LICENSE END ================ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <utki/debug.hpp>
+
+namespace curlydoc {
+
+// Maps names to dense integer ids.
+// Ids are assigned sequentially starting from 0 in the order of interning.
+class symbol_table {
+public:
+  using id_type = uint32_t;
+
+private:
+  std::unordered_map<std::string, id_type> ids;
+  std::vector<std::string> names;
+
+public:
+  id_type intern(const std::string &name);
+
+  std::optional<id_type> find(const std::string &name) const noexcept;
+
+  const std::string &name(id_type id) const noexcept {
+    ASSERT(id < this->names.size())
+    return this->names[id];
+  }
+
+  size_t size() const noexcept { return this->names.size(); }
+};
+
+} // namespace curlydoc
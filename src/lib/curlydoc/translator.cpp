@@ -21,8 +21,12 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "translator.hpp"
 
+#include <array>
+
 #include <utki/util.hpp>
 
+#include "memory_accounting.hpp"
+
 using namespace curlydoc;
 
 namespace {
@@ -30,7 +34,6 @@ const std::string double_quote = "\"";
 const std::string curly_brace_open = "{";
 const std::string curly_brace_close = "}";
 
-const std::string empty_tag = "";
 const std::string table_tag = "table";
 const std::string cell_tag = "cell";
 
@@ -38,149 +41,281 @@ const std::string list_tag = "list";
 const std::string list_item_tag = "li";
 } // namespace
 
-translator::translator() {
-  this->add_tag("g", [this](bool space, auto &forest) {
+enum class translator::builtin_tag : uint8_t {
+  g,
+  prm,
+  dq,
+  cb,
+  p,
+  b,
+  i,
+  u,
+  s,
+  m,
+  h1,
+  h2,
+  h3,
+  h4,
+  h5,
+  h6,
+  ins,
+  image,
+  table,
+  cell,
+  list,
+  li,
+
+  enum_size
+};
+
+namespace {
+const std::array<std::string, size_t(translator::builtin_tag::enum_size)>
+    builtin_tag_names = {"g",      "prm",    "dq",   "cb",     "p",
+                         "b",      "i",      "u",    "s",      "m",
+                         "h1",     "h2",     "h3",   "h4",     "h5",
+                         "h6",     "ins",    "image", table_tag, cell_tag,
+                         list_tag, list_item_tag};
+} // namespace
+
+std::optional<translator::builtin_tag>
+translator::find_builtin_tag(const std::string &tag) noexcept {
+  // dispatch on length and characters instead of hashing the whole string
+  switch (tag.size()) {
+  case 1:
+    switch (tag[0]) {
+    case 'g':
+      return builtin_tag::g;
+    case 'p':
+      return builtin_tag::p;
+    case 'b':
+      return builtin_tag::b;
+    case 'i':
+      return builtin_tag::i;
+    case 'u':
+      return builtin_tag::u;
+    case 's':
+      return builtin_tag::s;
+    case 'm':
+      return builtin_tag::m;
+    default:
+      return {};
+    }
+  case 2:
+    if (tag[0] == 'h' && tag[1] >= '1' && tag[1] <= '6') {
+      return builtin_tag(unsigned(builtin_tag::h1) + (tag[1] - '1'));
+    }
+    if (tag == "dq") {
+      return builtin_tag::dq;
+    }
+    if (tag == "cb") {
+      return builtin_tag::cb;
+    }
+    if (tag == list_item_tag) {
+      return builtin_tag::li;
+    }
+    return {};
+  case 3:
+    if (tag == "prm") {
+      return builtin_tag::prm;
+    }
+    if (tag == "ins") {
+      return builtin_tag::ins;
+    }
+    return {};
+  case 4:
+    if (tag == cell_tag) {
+      return builtin_tag::cell;
+    }
+    if (tag == list_tag) {
+      return builtin_tag::list;
+    }
+    return {};
+  case 5:
+    if (tag == "image") {
+      return builtin_tag::image;
+    }
+    if (tag == table_tag) {
+      return builtin_tag::table;
+    }
+    return {};
+  default:
+    return {};
+  }
+}
+
+void translator::translate(builtin_tag tag, bool space,
+                           const tml::forest_ext &forest) {
+  switch (tag) {
+  case builtin_tag::g:
     ASSERT(!forest.empty())
     this->report_space(space);
     this->translate(forest);
-  });
-
-  this->add_tag("prm", [](bool space, auto &forest) {
+    break;
+  case builtin_tag::prm:
     // ignore
-  });
-
-  this->add_tag("dq", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::dq:
     ASSERT(!forest.empty())
     this->report_space(space);
     this->on_word(double_quote);
     this->translate(forest);
     this->on_word(double_quote);
-  });
-
-  this->add_tag("cb", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::cb:
     ASSERT(!forest.empty())
     this->report_space(space);
     this->on_word(curly_brace_open);
     this->translate(forest);
     this->on_word(curly_brace_close);
-  });
-
-  this->add_tag(
-      "p", [this](bool space, auto &forest) { this->on_paragraph(forest); });
-
-  this->add_tag("b", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::p:
+    this->on_paragraph(forest);
+    break;
+  case builtin_tag::b:
     this->report_space(space);
     this->on_bold(forest);
-  });
-
-  this->add_tag("i", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::i:
     this->report_space(space);
     this->on_italic(forest);
-  });
-
-  this->add_tag("u", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::u:
     this->report_space(space);
     this->on_underline(forest);
-  });
-
-  this->add_tag("s", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::s:
     this->report_space(space);
     this->on_strikethrough(forest);
-  });
-
-  this->add_tag("m", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::m:
     this->report_space(space);
     this->on_monospace(forest);
-  });
-
-  this->add_tag("h1",
-                [this](bool space, auto &forest) { this->on_header1(forest); });
-
-  this->add_tag("h2",
-                [this](bool space, auto &forest) { this->on_header2(forest); });
-
-  this->add_tag("h3",
-                [this](bool space, auto &forest) { this->on_header3(forest); });
-
-  this->add_tag("h4",
-                [this](bool space, auto &forest) { this->on_header4(forest); });
-
-  this->add_tag("h5",
-                [this](bool space, auto &forest) { this->on_header5(forest); });
-
-  this->add_tag("h6",
-                [this](bool space, auto &forest) { this->on_header6(forest); });
-
-  this->add_tag("ins",
-                [this](bool space, auto &forest) { this->on_ins(forest); });
-
-  this->add_tag("image", [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::h1:
+    this->on_header1(forest);
+    break;
+  case builtin_tag::h2:
+    this->on_header2(forest);
+    break;
+  case builtin_tag::h3:
+    this->on_header3(forest);
+    break;
+  case builtin_tag::h4:
+    this->on_header4(forest);
+    break;
+  case builtin_tag::h5:
+    this->on_header5(forest);
+    break;
+  case builtin_tag::h6:
+    this->on_header6(forest);
+    break;
+  case builtin_tag::ins:
+    this->on_ins(forest);
+    break;
+  case builtin_tag::image:
     this->report_space(space);
     this->handle_image(forest);
-  });
-
-  this->add_tag(table_tag, [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::table:
     this->handle_table(forest);
-  });
-
-  this->add_tag(cell_tag, [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::cell:
     this->handle_cell(forest);
-  });
-
-  this->add_tag(list_tag, [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::list:
     this->handle_list(forest);
-  });
-
-  this->add_tag(list_item_tag, [this](bool space, auto &forest) {
+    break;
+  case builtin_tag::li:
     this->handle_list_item(forest);
-  });
+    break;
+  case builtin_tag::enum_size:
+    ASSERT(false)
+    break;
+  }
 }
 
 void translator::add_tag(const std::string &tag, handler_type &&func) {
-  auto i = this->handlers.insert(std::make_pair(tag, std::move(func)));
-  if (!i.second) {
+  ASSERT(func)
+
+  if (find_builtin_tag(tag)) {
     throw std::logic_error(std::string("tag '") + tag + "' is already added");
   }
+
+  auto id = this->tags.intern(tag);
+  if (id != this->handlers.size()) {
+    ASSERT(id < this->handlers.size())
+    throw std::logic_error(std::string("tag '") + tag + "' is already added");
+  }
+
+  this->handlers.push_back(std::move(func));
 }
 
-const std::string &translator::get_parent_tag() const noexcept {
+std::string_view translator::get_parent_tag() const noexcept {
   ASSERT(!this->cur_tag.empty())
-  for (auto i = std::next(this->cur_tag.rbegin()); i != this->cur_tag.rend();
-       ++i) {
-    if (!i->empty()) {
-      // std::cout << "ret = " << *i << '\n';
-      return *i;
-    }
+  auto parent = this->cur_tag.back().parent;
+  if (parent == no_parent) {
+    return {};
   }
-  return empty_tag;
+  ASSERT(parent < this->cur_tag.size())
+  return this->cur_tag[parent].name;
 }
 
 std::vector<std::string> translator::list_tags() const {
   std::vector<std::string> tags;
 
-  for (const auto &h : this->handlers) {
-    if (h.first == "prm") {
+  for (const auto &name : builtin_tag_names) {
+    if (name == "prm") {
       continue; // prm is not a tag, and it is just ignored by translator
     }
-    tags.push_back(h.first);
+    tags.push_back(name);
+  }
+
+  for (symbol_table::id_type id = 0; id != this->tags.size(); ++id) {
+    tags.push_back(this->tags.name(id));
   }
 
   return tags;
 }
 
 void translator::translate(bool space, const tml::tree_ext &tree) {
+  if (tree.children.empty()) {
+    this->report_space(space);
+    this->on_word(tree.value.string);
+    return;
+  }
+
   const auto &tag = tree.value.string;
 
-  auto handler_i = this->handlers.find(tag);
-  if (handler_i == this->handlers.end()) {
-    throw std::invalid_argument(std::string("tag not found: ") + tag);
+  // built-in tags are dispatched directly, the tags added with add_tag() are
+  // looked up in the table of handlers
+  auto builtin = find_builtin_tag(tag);
+
+  std::optional<symbol_table::id_type> id;
+  if (!builtin) {
+    id = this->tags.find(tag);
+    if (!id) {
+      throw std::invalid_argument(std::string("tag not found: ") + tag);
+    }
+    ASSERT(id.value() < this->handlers.size())
   }
 
-  this->cur_tag.push_back(tag);
+  {
+    // tags with empty name are skipped when looking for parent tag
+    size_t parent = no_parent;
+    if (!this->cur_tag.empty()) {
+      const auto &top = this->cur_tag.back();
+      parent = top.name.empty() ? top.parent : this->cur_tag.size() - 1;
+    }
+    this->cur_tag.push_back({tag, parent});
+  }
   utki::scope_exit cur_tag_scope_exit([this]() { this->cur_tag.pop_back(); });
 
   try {
-    handler_i->second(space, tree.children);
+    if (builtin) {
+      this->translate(builtin.value(), space, tree.children);
+    } else {
+      this->handlers[id.value()](space, tree.children);
+    }
   } catch (std::exception &e) {
     std::stringstream ss;
     ss << e.what() << " at:" << '\n';
@@ -193,19 +328,25 @@ void translator::translate(bool space, const tml::tree_ext &tree) {
 
 void translator::translate(tml::forest_ext::const_iterator begin,
                            tml::forest_ext::const_iterator end) {
+  memory_accounting::phase_scope phase_scope(
+      memory_accounting::phase::translate);
+
   for (auto i = begin; i != end; ++i) {
     bool space = i != begin && i->value.info.flags.get(tml::flag::space);
-
-    if (i->children.empty()) {
-      this->report_space(space);
-      this->on_word(i->value.string);
-      continue;
-    }
-
     this->translate(space, *i);
   }
 }
 
+void translator::translate_next(const tml::tree_ext &node) {
+  memory_accounting::phase_scope phase_scope(
+      memory_accounting::phase::translate);
+
+  bool space = !this->at_document_begin &&
+               node.value.info.flags.get(tml::flag::space);
+  this->at_document_begin = false;
+  this->translate(space, node);
+}
+
 void translator::report_space(bool report) {
   if (report) {
     this->on_word(" ");
@@ -485,8 +626,6 @@ void translator::handle_list(const tml::forest_ext &forest) {
   this->cur_list.emplace_back();
   utki::scope_exit cur_list_scope_exit([this]() { this->cur_list.pop_back(); });
 
-  auto &l = this->cur_list.back();
-
   ASSERT(!forest.empty())
   auto i = forest.begin();
 
@@ -495,7 +634,7 @@ void translator::handle_list(const tml::forest_ext &forest) {
       check_parameter(p);
 
       if (p == "ordered") {
-        l.ordered = p.children.front().value.to_bool();
+        this->cur_list.back().ordered = p.children.front().value.to_bool();
       }
     }
     ++i;
@@ -503,7 +642,9 @@ void translator::handle_list(const tml::forest_ext &forest) {
 
   this->translate(i, forest.end());
 
-  this->on_list(l, forest);
+  // NOTE: nested lists can reallocate the cur_list, so do not hold a
+  //       reference to the list across the translate() call
+  this->on_list(this->cur_list.back(), forest);
 }
 
 void translator::handle_list_item(const tml::forest_ext &forest) {
@@ -517,5 +658,6 @@ void translator::handle_list_item(const tml::forest_ext &forest) {
   ASSERT(
       !this->cur_list.empty()) // since we have checked the parent tag is 'list'
 
-  this->cur_list.back().items.push_back(forest);
+  // the item refers to the forest, which outlives the list being translated
+  this->cur_list.back().items.push_back({forest.begin(), forest.end()});
 }
@@ -22,21 +22,46 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include <optional>
-#include <unordered_map>
+#include <string_view>
 
 #include <tml/tree_ext.hpp>
 
+#include "symbol_table.hpp"
+
 namespace curlydoc {
 
+// Thread safety: a translator instance must only be used by one thread at a
+// time, separate instances can be used concurrently.
 class translator {
 public:
   using handler_type = std::function<void(bool, const tml::forest_ext &)>;
 
+  enum class builtin_tag : uint8_t;
+
 private:
-  std::unordered_map<std::string, handler_type> handlers;
+  static std::optional<builtin_tag>
+  find_builtin_tag(const std::string &tag) noexcept;
+
+  void translate(builtin_tag tag, bool space, const tml::forest_ext &forest);
+
+  // tags added with add_tag()
+  symbol_table tags;
+
+  // indexed by tag symbol id
+  std::vector<handler_type> handlers;
+
+  struct tag_stack_entry {
+    // refers to the translated forest
+    std::string_view name;
+
+    // index of the closest enclosing tag with non-empty name
+    size_t parent;
+  };
 
-  std::vector<std::string> cur_tag;
-  const std::string &get_parent_tag() const noexcept;
+  constexpr static size_t no_parent = ~size_t(0);
+
+  std::vector<tag_stack_entry> cur_tag;
+  std::string_view get_parent_tag() const noexcept;
 
   void handle_image(const tml::forest_ext &forest);
 
@@ -48,6 +73,9 @@ private:
 
   void translate(bool space, const tml::tree_ext &tree);
 
+  // for translate_next()
+  bool at_document_begin = true;
+
 protected:
   void report_space(bool report);
 
@@ -55,7 +83,7 @@ protected:
   static void check_parameter(const tml::tree_ext &forest);
 
 public:
-  translator();
+  translator() = default;
 
   translator(const translator &) = delete;
   translator &operator=(const translator &) = delete;
@@ -76,6 +104,11 @@ public:
     this->translate(forest.begin(), forest.end());
   }
 
+  // Translate the document node by node, e.g. as the nodes are produced by
+  // interpreter::eval(sink). Each call translates the next top-level node
+  // of the document.
+  void translate_next(const tml::tree_ext &node);
+
   virtual void on_word(const std::string &word) = 0;
 
   virtual void on_paragraph(const tml::forest_ext &forest) = 0;
@@ -164,9 +197,14 @@ private:
 public:
   virtual void on_table(const table &tbl, const tml::forest_ext &forest) = 0;
 
+  struct list_item {
+    tml::forest_ext::const_iterator begin;
+    tml::forest_ext::const_iterator end;
+  };
+
   struct list {
     bool ordered = false;
-    std::vector<tml::forest_ext> items;
+    std::vector<list_item> items;
   };
 
   virtual void on_list(const list &l, const tml::forest_ext &forest) = 0;
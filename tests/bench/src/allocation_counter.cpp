@@ -0,0 +1,43 @@
+#include "allocation_counter.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+size_t bench::num_allocations = 0;
+size_t bench::allocated_bytes = 0;
+size_t bench::peak_allocated_bytes = 0;
+
+// size of each memory block is stored in front of it to track the amount of allocated memory
+
+void* operator new(size_t size){
+	std::max_align_t* p = nullptr;
+
+	// as the standard operator new does, let the new handler free some memory and try again
+	while(!(p = static_cast<std::max_align_t*>(std::malloc(size + sizeof(std::max_align_t))))){
+		auto handler = std::get_new_handler();
+		if(!handler){
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+
+	++bench::num_allocations;
+	*reinterpret_cast<size_t*>(p) = size;
+	bench::allocated_bytes += size;
+	bench::peak_allocated_bytes = std::max(bench::peak_allocated_bytes, bench::allocated_bytes);
+	return p + 1;
+}
+
+void operator delete(void* p)noexcept{
+	if(!p){
+		return;
+	}
+	auto block = static_cast<std::max_align_t*>(p) - 1;
+	bench::allocated_bytes -= *reinterpret_cast<size_t*>(block);
+	std::free(block);
+}
+
+void operator delete(void* p, size_t)noexcept{
+	operator delete(p);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+// Global operator new and delete are replaced to count allocations.
+// They are defined in a separate translation unit, so that they are not
+// inlined into the code being measured.
+
+namespace bench{
+
+extern size_t num_allocations;
+extern size_t allocated_bytes;
+extern size_t peak_allocated_bytes;
+
+}
@@ -0,0 +1,156 @@
+#include "generator.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace bench;
+
+std::string bench::make_macro_calls_document(size_t num_rows, size_t num_distinct_args){
+	std::stringstream ss;
+
+	ss << R"(
+		defs{
+			badge{asis{ b{${@}} }}
+		}
+		defs{
+			row{asis{
+				p{ badge{${@}} i{some text about ${@}} for{ i{1 2 3} m{${i}} } }
+			}}
+		}
+	)";
+
+	for(size_t i = 0; i != num_rows; ++i){
+		ss << "row{item" << (i % num_distinct_args) << "}\n";
+	}
+
+	return ss.str();
+}
+
+std::string bench::make_deep_macro_nesting_document(size_t depth, size_t num_calls){
+	std::stringstream ss;
+
+	ss << "defs{ m0{asis{ b{${@}} }} }\n";
+	for(size_t i = 1; i != depth; ++i){
+		ss << "defs{ m" << i << "{asis{ i{ m" << (i - 1) << "{${@}} } }} }\n";
+	}
+
+	for(size_t i = 0; i != num_calls; ++i){
+		ss << "p{ m" << (depth - 1) << "{call " << i << "} }\n";
+	}
+
+	return ss.str();
+}
+
+std::string bench::make_for_loop_document(size_t num_values){
+	std::stringstream ss;
+
+	ss << "for{ i{";
+	for(size_t i = 0; i != num_values; ++i){
+		ss << " value" << i;
+	}
+	ss << " } p{ b{${i}} is one of the values } }";
+
+	return ss.str();
+}
+
+std::string bench::make_table_document(size_t num_rows){
+	std::stringstream ss;
+
+	ss << "table{ prm{ cols{4} border{1} weight{1 2 2 1} align{left left center right} }\n";
+
+	for(size_t i = 0; i != num_rows; ++i){
+		// spans repeat every 3 rows
+		switch(i % 3){
+			case 0:
+				ss << "cell{ prm{span{2}} wide " << i << " } cell{b{" << i << "}} cell{text}\n";
+				break;
+			case 1:
+				ss << "cell{ prm{span{1 2}} tall " << i << " } cell{b{" << i << "}} cell{text} cell{i{more}}\n";
+				break;
+			default:
+				ss << "cell{b{" << i << "}} cell{text} cell{i{more}}\n";
+				break;
+		}
+	}
+
+	ss << "}";
+
+	return ss.str();
+}
+
+std::string bench::make_long_list_document(size_t num_items){
+	std::stringstream ss;
+
+	ss << "list{\n";
+	for(size_t i = 0; i != num_items; ++i){
+		ss << "li{ item b{" << i << "} with some text }\n";
+	}
+	ss << "}";
+
+	return ss.str();
+}
+
+std::string bench::make_nested_lists_document(size_t depth){
+	std::stringstream ss;
+
+	for(size_t i = 0; i != depth; ++i){
+		ss << "list{ li{item} li{item} li{level " << i << " ";
+	}
+	for(size_t i = 0; i != depth; ++i){
+		ss << "} li{item} }";
+	}
+
+	return ss.str();
+}
+
+std::string bench::make_inline_text_document(size_t size){
+	const std::string words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit"};
+
+	std::stringstream ss;
+
+	for(size_t i = 0; size_t(ss.tellp()) < size; ++i){
+		if(i % 1000 == 0){
+			ss << (i == 0 ? "" : "}\n") << "p{\n";
+		}
+		if(i % 50 == 0){
+			ss << "b{" << words[i % std::size(words)] << "} ";
+		}else{
+			ss << words[i % std::size(words)] << ((i % 10 == 9) ? "\n" : " ");
+		}
+	}
+	ss << "}";
+
+	return ss.str();
+}
+
+namespace{
+void write_include_level(const std::string& file_name, const std::string& common_file_name, size_t fanout, size_t depth){
+	std::ofstream f(file_name, std::ios::binary);
+
+	f << "include{" << common_file_name << "}\n";
+	f << "p{ text of b{" << file_name << "} file }\n";
+
+	if(depth == 0){
+		return;
+	}
+
+	for(size_t i = 0; i != fanout; ++i){
+		auto child = file_name.substr(0, file_name.size() - std::string(".cudoc").size()) + "_" + std::to_string(i) + ".cudoc";
+		f << "include{" << child << "}\n";
+		write_include_level(child, common_file_name, fanout, depth - 1);
+	}
+}
+}
+
+std::string bench::make_include_tree(const std::string& dir, size_t fanout, size_t depth){
+	std::filesystem::create_directories(dir);
+
+	auto common_file_name = dir + "/common.cudoc";
+	std::ofstream(common_file_name, std::ios::binary) << "p{ common text i{included everywhere} }\n";
+
+	auto root_file_name = dir + "/f.cudoc";
+	write_include_level(root_file_name, common_file_name, fanout, depth);
+
+	return root_file_name;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+// Synthetic documents for benchmarking, each stresses a particular part of the interpreter or the translator.
+
+namespace bench{
+
+// document which calls a few small macros many times, with the given number of distinct arguments
+std::string make_macro_calls_document(size_t num_rows, size_t num_distinct_args);
+
+// chain of macros, each calling the next one, called the given number of times
+std::string make_deep_macro_nesting_document(size_t depth, size_t num_calls);
+
+// for loop over the given number of values
+std::string make_for_loop_document(size_t num_values);
+
+// table with cells spanning several columns and rows
+std::string make_table_document(size_t num_rows);
+
+// flat list with the given number of items
+std::string make_long_list_document(size_t num_items);
+
+// list nested to the given depth, with a few items on each level
+std::string make_nested_lists_document(size_t depth);
+
+// paragraphs of plain text with occasional formatting, of roughly the given size in bytes
+std::string make_inline_text_document(size_t size);
+
+// Tree of files, each including the given number of files of the next level.
+// All the files also include one common file. Returns name of the root file.
+std::string make_include_tree(const std::string& dir, size_t fanout, size_t depth);
+
+}
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+
+#include <sys/resource.h>
+
+#if defined(__GLIBC__)
+#	include <malloc.h>
+#endif
+
+#include <clargs/parser.hpp>
+#include <papki/fs_file.hpp>
+#include <utki/util.hpp>
+
+#include "../../src/lib/curlydoc/interpreter.hpp"
+#include "../../src/curlydoc-html/translator_to_html.hpp"
+
+#include "allocation_counter.hpp"
+#include "generator.hpp"
+
+using namespace bench;
+
+namespace{
+// Peak resident set size is reset before each measurement, so that it is
+// reported per phase. Resetting is only supported on Linux, elsewhere the
+// peak of the whole process so far is reported.
+bool reset_peak_rss(){
+#if defined(__GLIBC__)
+	// return memory freed by previous measurements to the system
+	malloc_trim(0);
+#endif
+
+	std::ofstream f("/proc/self/clear_refs");
+	f << "5";
+	f.flush();
+	return bool(f);
+}
+
+size_t get_peak_rss_kb(){
+	std::ifstream f("/proc/self/status");
+	for(std::string line; std::getline(f, line);){
+		if(line.rfind("VmHWM:", 0) == 0){
+			return std::stoul(line.substr(line.find_first_of("0123456789")));
+		}
+	}
+
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return size_t(usage.ru_maxrss);
+}
+}
+
+namespace{
+struct measurement{
+	std::string name;
+	std::string phase;
+	size_t nodes = 0;
+	std::vector<size_t> times_us;
+	size_t allocations = 0;
+	size_t peak_heap_bytes = 0;
+	size_t peak_rss_kb = 0;
+
+	size_t min_time_us()const{
+		return *std::min_element(this->times_us.begin(), this->times_us.end());
+	}
+
+	size_t median_time_us()const{
+		auto t = this->times_us;
+		std::nth_element(t.begin(), t.begin() + t.size() / 2, t.end());
+		return t[t.size() / 2];
+	}
+};
+
+// Run the function the given number of times plus one warm-up run.
+// The function returns the number of produced nodes.
+// The prepare function is called before each run outside of the measured time.
+measurement measure(const std::string& name, const std::string& phase, size_t num_runs, const std::function<size_t()>& func, const std::function<void()>& prepare = nullptr){
+	measurement m;
+	m.name = name;
+	m.phase = phase;
+
+	if(prepare){
+		prepare();
+	}
+	func();
+
+	for(size_t i = 0; i != num_runs; ++i){
+		if(prepare){
+			prepare();
+		}
+
+		reset_peak_rss();
+
+		size_t allocs_before = num_allocations;
+		size_t bytes_before = allocated_bytes;
+		peak_allocated_bytes = allocated_bytes;
+		auto start = std::chrono::steady_clock::now();
+
+		m.nodes = func();
+
+		auto end = std::chrono::steady_clock::now();
+
+		m.times_us.push_back(size_t(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()));
+
+		// these do not change between runs, except for the resident set size
+		m.allocations = num_allocations - allocs_before;
+		m.peak_heap_bytes = peak_allocated_bytes - bytes_before;
+		m.peak_rss_kb = std::max(m.peak_rss_kb, get_peak_rss_kb());
+	}
+
+	return m;
+}
+}
+
+namespace{
+class null_sink : public curlydoc::output_sink{
+public:
+	void write(std::string_view data)override{}
+};
+
+std::vector<std::string> list_html_tags(){
+	null_sink out;
+	return curlydoc::translator_to_html(out).list_tags();
+}
+
+struct scenario{
+	std::string name;
+
+	// document text, or root file name of the document if it is split into files
+	std::function<std::string()> generate;
+	bool is_file = false;
+
+	bool memoize = false;
+};
+
+const std::vector<scenario> scenarios = {
+	{"macro_calls", [](){return bench::make_macro_calls_document(10000, 10000);}},
+	{"macro_calls_memoized", [](){return bench::make_macro_calls_document(10000, 10000);}, false, true},
+	{"repeated_macro_calls", [](){return bench::make_macro_calls_document(10000, 10);}},
+	{"repeated_macro_calls_memoized", [](){return bench::make_macro_calls_document(10000, 10);}, false, true},
+	{"deep_macro_nesting", [](){return bench::make_deep_macro_nesting_document(100, 200);}},
+	{"for_loop", [](){return bench::make_for_loop_document(20000);}},
+	{"table", [](){return bench::make_table_document(6000);}},
+	{"long_list", [](){return bench::make_long_list_document(20000);}},
+	// memory used for translation should grow linearly with the depth
+	{"nested_lists_100", [](){return bench::make_nested_lists_document(100);}},
+	{"nested_lists_200", [](){return bench::make_nested_lists_document(200);}},
+	{"nested_lists_400", [](){return bench::make_nested_lists_document(400);}},
+	{"inline_text", [](){return bench::make_inline_text_document(0x100000);}},
+	{"include_tree", [](){return bench::make_include_tree("bench_include_tree.tmp", 6, 3);}, true},
+};
+
+// evaluation and translation are measured separately
+void run(const scenario& s, size_t num_runs, const std::function<void(const measurement&)>& report){
+	auto doc = s.generate();
+
+	utki::scope_exit remove_files_scope_exit([&](){
+		if(s.is_file){
+			std::filesystem::remove_all(std::filesystem::path(doc).parent_path());
+		}
+	});
+
+	auto tags = list_html_tags();
+
+	// the document is parsed outside of the measured time,
+	// included files are parsed as part of the evaluation
+	auto parsed = s.is_file ? tml::read_ext(papki::fs_file(doc)) : tml::read_ext(doc);
+
+	std::optional<curlydoc::interpreter> interpreter;
+	tml::forest_ext evaled;
+
+	report(measure(
+			s.name,
+			"eval",
+			num_runs,
+			[&](){
+				evaled = interpreter->eval(parsed);
+				return evaled.size();
+			},
+			[&](){
+				std::unique_ptr<papki::file> file;
+				if(s.is_file){
+					// for including files
+					file = std::make_unique<papki::fs_file>(doc);
+				}
+
+				interpreter.reset();
+				interpreter.emplace(std::move(file));
+				interpreter->enable_memoization(s.memoize);
+				interpreter->add_repeater_functions(tags);
+
+				evaled.clear();
+			}
+		));
+
+	report(measure(s.name, "translate", num_runs, [&](){
+		null_sink out;
+		curlydoc::translator_to_html translator(out);
+		translator.translate(evaled);
+		return evaled.size();
+	}));
+}
+
+void run_construction(size_t num_runs, const std::function<void(const measurement&)>& report){
+	constexpr size_t num_interpreters = 1000;
+
+	report(measure("interpreters_" + std::to_string(num_interpreters), "construction", num_runs, [&](){
+		for(size_t i = 0; i != num_interpreters; ++i){
+			curlydoc::interpreter interpreter(nullptr);
+		}
+		return 0;
+	}));
+
+	curlydoc::interpreter prelude(nullptr);
+	auto snapshot = prelude.make_snapshot();
+
+	report(measure("interpreters_" + std::to_string(num_interpreters), "fork", num_runs, [&](){
+		for(size_t i = 0; i != num_interpreters; ++i){
+			curlydoc::interpreter interpreter(snapshot, nullptr);
+		}
+		return 0;
+	}));
+}
+}
+
+int main(int argc, const char** argv){
+	clargs::parser cli;
+
+	size_t num_runs = 5;
+	bool json = false;
+	std::string filter;
+	std::string generate;
+
+	cli.add("runs", "number of measured runs of each benchmark, the time is reported as minimum and median of them, defaults to 5", [&](std::string_view v){
+		auto res = std::from_chars(v.data(), v.data() + v.size(), num_runs);
+		if(res.ec != std::errc() || res.ptr != v.data() + v.size() || num_runs == 0){
+			std::stringstream ss;
+			ss << "invalid value of --runs: '" << v << "', expected a positive number";
+			throw std::invalid_argument(ss.str());
+		}
+	});
+	cli.add("json", "output results in JSON format", [&](){json = true;});
+	cli.add("filter", "only run benchmarks whose names contain the given string", [&](std::string_view v){filter = v;});
+	cli.add("generate", "write document of the given benchmark to standard output, or to files in case of include_tree, instead of running benchmarks", [&](std::string_view v){generate = v;});
+
+	try{
+		cli.parse(argc, argv);
+	}catch(std::invalid_argument& e){
+		std::cout << "error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	if(!generate.empty()){
+		auto i = std::find_if(scenarios.begin(), scenarios.end(), [&](const auto& s){return s.name == generate;});
+		if(i == scenarios.end()){
+			std::cout << "error: unknown benchmark: " << generate << std::endl;
+			return 1;
+		}
+		std::cout << i->generate();
+		if(i->is_file){
+			std::cout << std::endl;
+		}
+		return 0;
+	}
+
+	std::vector<measurement> results;
+
+	auto report = [&](const measurement& m){
+		if(json){
+			results.push_back(m);
+			return;
+		}
+		std::cout << m.name << " " << m.phase << ": "
+				<< "nodes = " << m.nodes << ", "
+				<< "time = " << m.min_time_us() << " us (median " << m.median_time_us() << " us), "
+				<< "allocations = " << m.allocations << ", "
+				<< "peak heap = " << m.peak_heap_bytes << " bytes, "
+				<< "peak RSS = " << m.peak_rss_kb << " kB"
+				<< std::endl;
+	};
+
+	if(std::string("construction").find(filter) != std::string::npos){
+		run_construction(num_runs, report);
+	}
+
+	for(const auto& s : scenarios){
+		if(s.name.find(filter) != std::string::npos){
+			run(s, num_runs, report);
+		}
+	}
+
+	if(json){
+		std::cout << "{\n"
+				<< "\t\"runs\": " << num_runs << ",\n"
+				<< "\t\"per_phase_peak_rss\": " << (reset_peak_rss() ? "true" : "false") << ",\n"
+				<< "\t\"benchmarks\": [";
+		for(const auto& m : results){
+			std::cout << (&m == &results.front() ? "\n" : ",\n")
+					<< "\t\t{"
+					<< "\"name\": \"" << m.name << "\", "
+					<< "\"phase\": \"" << m.phase << "\", "
+					<< "\"nodes\": " << m.nodes << ", "
+					<< "\"time_min_us\": " << m.min_time_us() << ", "
+					<< "\"time_median_us\": " << m.median_time_us() << ", "
+					<< "\"allocations\": " << m.allocations << ", "
+					<< "\"peak_heap_bytes\": " << m.peak_heap_bytes << ", "
+					<< "\"peak_rss_kb\": " << m.peak_rss_kb
+					<< "}";
+		}
+		std::cout << "\n\t]\n}" << std::endl;
+	}
+
+	return 0;
+}
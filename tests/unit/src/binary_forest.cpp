@@ -0,0 +1,147 @@
+#include <tst/set.hpp>
+#include <tst/check.hpp>
+
+#include <cstdio>
+
+#include "../../src/lib/curlydoc/binary_forest.hpp"
+#include "../../src/lib/curlydoc/mapped_file.hpp"
+
+namespace{
+bool is_same(const tml::forest_ext& a, const tml::forest_ext& b){
+	if(a.size() != b.size()){
+		return false;
+	}
+	for(size_t i = 0; i != a.size(); ++i){
+		const auto& x = a[i].value;
+		const auto& y = b[i].value;
+		if(x.to_string() != y.to_string() ||
+				x.info.location.line != y.info.location.line ||
+				x.info.location.offset != y.info.location.offset ||
+				!(x.info.flags == y.info.flags) ||
+				!is_same(a[i].children, b[i].children))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+}
+
+namespace{
+const tst::set set0("binary_forest", [](tst::suite& suite){
+	suite.add<std::string>(
+			"round_trip",
+			{
+				"",
+				"hello",
+				"hello world",
+				R"(a{b{c d} "quoted string" e{}} f{b{c}} g{""})",
+				R"(a{b{c{d{e{f{g{h}}}}}}} i j{k l{m n}})",
+			},
+			[](const auto& p){
+				auto forest = tml::read_ext(p);
+
+				curlydoc::memory_sink out;
+				curlydoc::write_binary(forest, out);
+
+				auto data = utki::make_span(
+						reinterpret_cast<const uint8_t*>(out.str().data()),
+						out.str().size()
+					);
+
+				curlydoc::binary_forest bf(data);
+
+				tst::check(is_same(bf.to_forest(), forest), SL) << "forest = " << forest;
+			}
+		);
+
+	suite.add(
+			"walk_in_place",
+			[](){
+				auto forest = tml::read_ext("a{b c{d}} e");
+
+				curlydoc::memory_sink out;
+				curlydoc::write_binary(forest, out);
+
+				curlydoc::binary_forest bf(utki::make_span(
+						reinterpret_cast<const uint8_t*>(out.str().data()),
+						out.str().size()
+					));
+
+				tst::check_eq(bf.size(), size_t(5), SL);
+
+				tst::check_eq(bf.value(0), std::string_view("a"), SL);
+				tst::check_eq(bf.next(0), size_t(4), SL);
+				tst::check_eq(bf.value(1), std::string_view("b"), SL);
+				tst::check_eq(bf.next(1), size_t(2), SL);
+				tst::check_eq(bf.value(2), std::string_view("c"), SL);
+				tst::check_eq(bf.next(2), size_t(4), SL);
+				tst::check_eq(bf.value(4), std::string_view("e"), SL);
+				tst::check_eq(bf.next(4), size_t(5), SL);
+			}
+		);
+
+	suite.add(
+			"equal_strings_are_stored_once",
+			[](){
+				curlydoc::memory_sink once;
+				curlydoc::write_binary(tml::read_ext("some_long_word"), once);
+
+				curlydoc::memory_sink many;
+				curlydoc::write_binary(tml::read_ext("some_long_word some_long_word some_long_word"), many);
+
+				// only two more nodes, no more string data
+				tst::check_eq(many.str().size(), once.str().size() + 2 * 5 * sizeof(uint32_t), SL);
+			}
+		);
+
+	suite.add<std::string>(
+			"invalid_data_throws",
+			{
+				"",
+				"CDBF",
+				std::string("XXXX\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 20),
+				// valid empty forest with an extra byte
+				std::string("CDBF\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 20) + "x",
+				// node refers to missing string
+				std::string(
+						"CDBF\x01\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00"
+						"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+						40
+					),
+			},
+			[](const auto& p){
+				auto data = utki::make_span(reinterpret_cast<const uint8_t*>(p.data()), p.size());
+				bool thrown = false;
+				try{
+					curlydoc::binary_forest bf(data);
+				}catch(std::invalid_argument&){
+					thrown = true;
+				}
+				tst::check(thrown, SL);
+			}
+		);
+
+	suite.add(
+			"mapped_file_reads_file",
+			[](){
+				const std::string file_name = "binary_forest_test.tmp";
+
+				auto forest = tml::read_ext("a{b c{d}} e");
+				{
+					curlydoc::fd_sink out(file_name);
+					curlydoc::write_binary(forest, out);
+				}
+
+				bool ok;
+				{
+					curlydoc::mapped_file f(file_name);
+					ok = is_same(curlydoc::binary_forest(f.data()).to_forest(), forest);
+				}
+				std::remove(file_name.c_str());
+
+				tst::check(ok, SL);
+			}
+		);
+});
+}
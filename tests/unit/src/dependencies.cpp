@@ -0,0 +1,50 @@
+#include <tst/set.hpp>
+#include <tst/check.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+#include "../../src/curlydoc-html/dependencies.hpp"
+
+namespace{
+const tst::set set0("dependencies", [](tst::suite& suite){
+	suite.add(
+			"changed_file_makes_manifest_outdated",
+			[](){
+				const std::string source_file_name = "dependencies_test_source.tmp";
+				const std::string manifest_file_name = "dependencies_test_manifest.tmp";
+
+				std::ofstream(source_file_name, std::ios::binary) << "hello";
+
+				{
+					curlydoc::file_hasher hasher;
+					curlydoc::dependency_manifest deps;
+					tst::check(deps.add(source_file_name, hasher), SL);
+					tst::check(!deps.add("non_existing_file.tmp", hasher), SL);
+					deps.save(manifest_file_name);
+				}
+
+				{
+					curlydoc::file_hasher hasher;
+					auto deps = curlydoc::dependency_manifest::load(manifest_file_name);
+					tst::check(deps.has_value(), SL);
+					tst::check(deps.value().is_up_to_date(hasher), SL);
+				}
+
+				std::ofstream(source_file_name, std::ios::binary) << "hello world";
+
+				{
+					curlydoc::file_hasher hasher;
+					auto deps = curlydoc::dependency_manifest::load(manifest_file_name);
+					tst::check(deps.has_value(), SL);
+					tst::check(!deps.value().is_up_to_date(hasher), SL);
+				}
+
+				std::remove(source_file_name.c_str());
+				std::remove(manifest_file_name.c_str());
+
+				tst::check(!curlydoc::dependency_manifest::load(manifest_file_name).has_value(), SL);
+			}
+		);
+});
+}
@@ -0,0 +1,42 @@
+#include <tst/set.hpp>
+#include <tst/check.hpp>
+
+#include "../../src/curlydoc-html/html_escape.hpp"
+
+namespace{
+const tst::set set0("html_escape", [](tst::suite& suite){
+	suite.add<std::pair<std::string, std::string>>(
+			"escaped_text_is_as_expected",
+			// pairs are {input, expected output}
+			{
+				{"", ""},
+				{"hello", "hello"},
+				{"a<b", "a&lt;b"},
+				{"<>&\"", "&lt;&gt;&amp;&quot;"},
+				{"\"quoted\"", "&quot;quoted&quot;"},
+				{"no special characters in this long enough text to fill a few vector registers", "no special characters in this long enough text to fill a few vector registers"},
+				{"special character at the end of a long enough text to fill a few vector registers&", "special character at the end of a long enough text to fill a few vector registers&amp;"},
+			},
+			[](const auto& p){
+				curlydoc::memory_sink out;
+				curlydoc::write_html_escaped(out, p.first);
+				tst::check_eq(out.str(), p.second, SL);
+			}
+		);
+
+	suite.add<size_t>(
+			"special_character_at_any_position_is_escaped",
+			{0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100},
+			[](const auto& pos){
+				std::string text(101, 'a');
+				text[pos] = '<';
+
+				curlydoc::memory_sink out;
+				curlydoc::write_html_escaped(out, text);
+
+				auto expected = text.substr(0, pos) + "&lt;" + text.substr(pos + 1);
+				tst::check_eq(out.str(), expected, SL);
+			}
+		);
+});
+}
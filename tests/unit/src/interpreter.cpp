@@ -6,6 +6,7 @@
 #include "dummy_translator.hpp"
 
 #include "../../src/lib/curlydoc/interpreter.hpp"
+#include "../../src/curlydoc-html/dependencies.hpp"
 
 namespace{
 const tst::set set0("interpreter", [](tst::suite& suite){
@@ -503,22 +504,430 @@ const tst::set set0("interpreter", [](tst::suite& suite){
 					}
 					if{gt{${v2} ${v}}}then{hello}else{world}
 				)", "hello"},
+
+				// compiled macros
+				{R"(
+					defs{
+						tmpl{asis{
+							hi ${@} b{${@}} bye
+						}}
+					}
+					for{ i{1 2} tmpl{${i}} }
+				)", "hi 1 b{1}bye hi 2 b{2}bye"},
+				{R"(
+					defs{
+						${asis{dollar}}
+					}
+					defs{
+						tmpl{asis{${@}}}
+					}
+					tmpl{bla}
+				)", "dollar"},
+
+				// variable values as parts of arguments
+				{R"(
+					defs{
+						v{asis{bla bla{hi} bla}}
+					}
+					size{defs{x{a b}} ${x} ${v}} at{1 x ${v}} slice{1 4 x ${v} y}
+				)", "5 bla bla bla{hi}bla"},
+				{R"(
+					defs{
+						v{map{a{hello} b{world}}}
+					}
+					get{b ${v}} children{at{0 ${v}}}
+				)", "world hello"},
+
+				// macro sees definitions visible at the point of its definition
+				{R"(
+					defs{ v{outer} }
+					defs{ m{asis{ ${v} ${@} }} }
+					defs{ v{inner} }
+					for{ i{1 2} defs{ v{loop} } m{${v}} }
+				)", "outer loop outer loop"},
+
+				// repeated macro calls
+				{R"(
+					defs{ m{asis{ b{${@}} }} }
+					m{1} m{1} m{2} m{1}
+				)", "b{1}b{1}b{2}b{1}"},
+				{R"(
+					defs{ cond{asis{ if{${@}} }} }
+					cond{x}then{a}else{b} cond{x}then{c}else{d} cond{not{x}}then{e}else{f}
+				)", "a c f"},
+				{R"(
+					defs{ t{asis{ then{${@}} }} }
+					if{x} t{a} if{not{x}} t{a} if{x} t{a}
+				)", "a a"},
+				{R"(
+					defs{ t{asis{ if{x} then{${@}} }} }
+					if{not{x}} t{a} if{not{x}} t{a}
+				)", "a a"},
 			},
 			[](auto& p){
-				curlydoc::interpreter interpreter(std::make_unique<papki::fs_file>("none"));
+				for(bool memoize : {false, true}){
+					curlydoc::interpreter interpreter(std::make_unique<papki::fs_file>("none"));
+
+					dummy_translator tr;
+
+					interpreter.add_repeater_functions(tr.list_tags());
+					interpreter.enable_memoization(memoize);
+
+					const auto in = tml::read_ext(p.first);
+
+					auto res = interpreter.eval(in.begin(), in.end());
+					tst::check(
+							res == tml::read_ext(p.second),
+							[&](auto&o){o << "memoize = " << memoize << ", res = " << tml::to_non_ext(res);},
+							SL
+						);
+				}
+			}
+		);
+
+	suite.add(
+			"memoization_cache_is_bounded",
+			[](){
+				std::string doc = "defs{m{asis{b{${@}} c{${@}}}}}";
+				for(unsigned i = 0; i != 1000; ++i){
+					doc += " m{" + std::to_string(i) + "}";
+				}
+				const auto in = tml::read_ext(doc);
+
+				const std::vector<std::string> tags = {"b", "c"};
+
+				curlydoc::interpreter reference(nullptr);
+				reference.add_repeater_functions(tags);
+				auto expected = reference.eval(in);
+
+				curlydoc::interpreter interpreter(nullptr);
+				interpreter.add_repeater_functions(tags);
+				interpreter.enable_memoization();
+
+				constexpr size_t max_size = 10000;
+				interpreter.set_max_memo_cache_size(max_size);
+
+				for(unsigned i = 0; i != 2; ++i){
+					auto res = interpreter.eval(in);
+					tst::check(res == expected, SL);
+					tst::check(interpreter.get_memo_cache_size() != 0, SL);
+					tst::check(interpreter.get_memo_cache_size() <= max_size, SL) << interpreter.get_memo_cache_size();
+				}
+
+				interpreter.enable_memoization(false);
+				tst::check_eq(interpreter.get_memo_cache_size(), size_t(0), SL);
+			}
+		);
+
+	suite.add(
+			"included_file_is_parsed_once",
+			[](){
+				auto cache = std::make_shared<curlydoc::include_cache>();
+
+				const auto in = tml::read_ext("include{testdata/include.cudoc} include{testdata/include.cudoc} ${inc_var1}");
+
+				for(unsigned i = 0; i != 2; ++i){
+					curlydoc::interpreter interpreter(std::make_unique<papki::fs_file>("none"));
+					interpreter.set_include_cache(cache);
+
+					auto res = interpreter.eval(in);
+					tst::check(
+							res == tml::read_ext("Hi Hi Hello"),
+							[&](auto&o){o << "res = " << tml::to_non_ext(res);},
+							SL
+						);
+				}
+
+				tst::check_eq(cache->size(), size_t(1), SL);
+
+				{
+					curlydoc::interpreter interpreter(std::make_unique<papki::fs_file>("none"));
+					interpreter.eval(in);
+					tst::check(interpreter.get_included_file_names() == std::vector<std::string>{"testdata/include.cudoc"}, SL);
+
+					// the hash is of the contents which were read for evaluation
+					const auto& hashes = interpreter.get_file_hashes();
+					tst::check_eq(hashes.size(), size_t(1), SL);
+					curlydoc::file_hasher hasher;
+					tst::check(hashes.at("testdata/include.cudoc") == hasher.hash("testdata/include.cudoc"), SL);
+				}
+
+				papki::fs_file fi("testdata/include.cudoc");
+				tst::check(cache->get(fi) == cache->get(fi), SL);
+			}
+		);
+
+	suite.add(
+			"forked_interpreters_are_independent",
+			[](){
+				curlydoc::interpreter prelude(nullptr);
+				prelude.add_repeater_function("b");
+				prelude.eval(tml::read_ext("defs{v{hello}} defs{m{asis{b{${v} ${@}}}}}"), true);
+
+				auto snap = prelude.make_snapshot();
+
+				curlydoc::interpreter i1(snap, nullptr);
+				curlydoc::interpreter i2(snap, nullptr);
+
+				i1.add_function("f", [](curlydoc::interpreter&, const tml::forest_ext&){
+					return tml::forest_ext{{"from_f"}};
+				});
+
+				auto res1 = i1.eval(tml::read_ext("m{world} f{x} defs{v{bye}} ${v}"), true);
+				tst::check(res1 == tml::read_ext("b{hello world} from_f bye"), [&](auto&o){o << "res1 = " << tml::to_non_ext(res1);}, SL);
+
+				auto res2 = i2.eval(tml::read_ext("m{world} ${v}"));
+				tst::check(res2 == tml::read_ext("b{hello world} hello"), [&](auto&o){o << "res2 = " << tml::to_non_ext(res2);}, SL);
+
+				bool thrown = false;
+				try{
+					i2.eval(tml::read_ext("f{x}"));
+				}catch(curlydoc::interpreter::exception&){
+					thrown = true;
+				}
+				tst::check(thrown, SL);
+
+				// memoization settings are inherited
+				for(size_t max_size : {size_t(1), curlydoc::interpreter::default_max_memo_cache_size}){
+					curlydoc::interpreter prelude(nullptr);
+					prelude.enable_memoization();
+					prelude.set_max_memo_cache_size(max_size);
+					prelude.eval(tml::read_ext("defs{m{asis{x y}}}"), true);
+
+					curlydoc::interpreter forked(prelude.make_snapshot(), nullptr);
+					forked.eval(tml::read_ext("m{1} m{1}"));
+
+					// the output does not fit the smaller cache
+					tst::check_eq(forked.get_memo_cache_size() != 0, max_size != 1, SL);
+				}
+			}
+		);
+
+	suite.add(
+			"profiler_counts_calls",
+			[](){
+				curlydoc::interpreter interpreter(nullptr);
+				interpreter.add_repeater_function("b");
+
+				auto prof = std::make_shared<curlydoc::profiler>(true);
+				interpreter.set_profiler(prof);
 
-				dummy_translator tr;
+				auto res = interpreter.eval(tml::read_ext(R"(
+					defs{m{asis{b{${@}}}}}
+					m{x} m{y}
+					defs{m{asis{${@}}}} m{z}
+				)"));
 
-				interpreter.add_repeater_functions(tr.list_tags());
+				tst::check(res == tml::read_ext("b{x} b{y} z"), [&](auto&o){o << "res = " << tml::to_non_ext(res);}, SL);
 
-				const auto in = tml::read_ext(p.first);
+				auto find = [&](curlydoc::profiler::kind k, std::string_view name){
+					std::vector<curlydoc::profiler::entry> ret;
+					for(const auto& e : prof->get_entries()){
+						if(e.kind == k && e.name == name){
+							ret.push_back(e);
+						}
+					}
+					return ret;
+				};
+
+				// macros with the same name are told apart by definition site
+				auto macros = find(curlydoc::profiler::kind::macro, "m");
+				tst::check_eq(macros.size(), size_t(2), SL);
+				tst::check_eq(macros[0].calls, size_t(2), SL);
+				tst::check_eq(macros[0].output_bytes, size_t(4), SL);
+				tst::check_eq(macros[1].calls, size_t(1), SL);
+				tst::check_eq(macros[1].output_bytes, size_t(1), SL);
+				tst::check(macros[0].site != macros[1].site, SL);
+
+				auto b = find(curlydoc::profiler::kind::function, "b");
+				tst::check_eq(b.size(), size_t(1), SL);
+				tst::check_eq(b[0].calls, size_t(2), SL);
+				tst::check_eq(b[0].output_bytes, size_t(4), SL);
+				tst::check(b[0].inclusive_time >= b[0].exclusive_time, SL);
+
+				// nested calls are not counted in exclusive time
+				tst::check(macros[0].inclusive_time >= macros[0].exclusive_time + b[0].inclusive_time, SL);
+
+				std::stringstream trace;
+				prof->write_trace(trace);
+				tst::check(trace.str().find(R"("name":"m")") != std::string::npos, SL) << trace.str();
+
+				// output of nested calls is counted in the output of the enclosing ones
+				{
+					curlydoc::interpreter interpreter(nullptr);
+					interpreter.add_repeater_function("b");
+
+					auto prof = std::make_shared<curlydoc::profiler>();
+					interpreter.set_profiler(prof);
+
+					interpreter.eval(tml::read_ext("defs{m{asis{b{${@} z}}}} b{asis{p q} m{r}}"));
+
+					for(const auto& e : prof->get_entries()){
+						if(e.name == "b"){
+							// b{p q b{r z}} and b{r z}
+							tst::check_eq(e.output_bytes, size_t(6 + 3), SL) << e.output_bytes;
+						}else if(e.name == "m"){
+							tst::check_eq(e.output_bytes, size_t(3), SL) << e.output_bytes;
+						}else if(e.name == "asis"){
+							// p q, and b{${@} z} of the macro definition
+							tst::check_eq(e.output_bytes, size_t(2 + 4), SL) << e.output_bytes;
+						}
+					}
+				}
+			}
+		);
+
+	suite.add(
+			"limits_abort_evaluation",
+			[](){
+				auto nested = [](const std::string& open, size_t depth){
+					std::string ret;
+					for(size_t i = 0; i != depth; ++i){
+						ret += open;
+					}
+					ret += "x";
+					ret += std::string(depth, '}');
+					return ret;
+				};
+
+				auto eval = [](const std::string& doc, const curlydoc::interpreter::limits& lim, bool memoize = false){
+					curlydoc::interpreter interpreter(nullptr);
+					interpreter.add_repeater_function("b");
+					interpreter.enable_memoization(memoize);
+					interpreter.set_limits(lim);
+					try{
+						interpreter.eval(tml::read_ext(doc));
+					}catch(curlydoc::interpreter::exception& e){
+						return std::string(e.what());
+					}
+					return std::string();
+				};
+
+				curlydoc::interpreter::limits lim;
+
+				lim.max_depth = 50;
+				tst::check(eval(nested("for{i{1} ", 50), lim).empty(), SL);
+				auto error = eval(nested("for{i{1} ", 51), lim);
+				tst::check(error.find("call depth limit (50) exceeded") != std::string::npos, SL) << error;
+				tst::check(error.find(":1:1: for") != std::string::npos, SL) << error;
+				tst::check(error.find("... 19 more calls ...") != std::string::npos, SL) << error;
+
+				// repeater functions and macros are evaluated without native recursion
+				tst::check(eval(nested("b{", 1000), lim).empty(), SL);
+				tst::check(eval("defs{m{asis{b{${@}}}}}" + nested("m{", 1000), lim).empty(), SL);
+
+				lim = {};
+				lim.max_nodes = 100;
+				tst::check(eval("for{i{1 2 3} a b c}", lim).empty(), SL);
+				error = eval("for{i{1 2 3} for{j{1 2 3 4 5 6 7 8 9 10} a b c d}}", lim);
+				tst::check(error.find("output node limit (100) exceeded") != std::string::npos, SL) << error;
+
+				// each node is counted once, however deep the calls producing it are nested
+				lim.max_nodes = 1;
+				tst::check(eval("for{i{1} for{j{1} for{k{1} for{l{1} x}}}}", lim).empty(), SL);
+				lim.max_nodes = 6;
+				tst::check(eval("for{i{1 2} for{j{1 2 3} x}}", lim).empty(), SL);
+				lim.max_nodes = 5;
+				error = eval("for{i{1 2} for{j{1 2 3} x}}", lim);
+				tst::check(error.find("output node limit (5) exceeded") != std::string::npos, SL) << error;
+
+				// a memoized macro call counts the same nodes as the evaluated one,
+				// the definition, and the arguments and the output of each call are counted
+				for(bool memoize : {false, true}){
+					lim.max_nodes = 8;
+					tst::check(eval("defs{m{asis{x y}}} m{1} m{1}", lim, memoize).empty(), SL);
+					lim.max_nodes = 7;
+					error = eval("defs{m{asis{x y}}} m{1} m{1}", lim, memoize);
+					tst::check(error.find("output node limit (7) exceeded") != std::string::npos, SL) << error;
+				}
+
+				lim = {};
+				lim.max_expansions = 3;
+				tst::check(eval("defs{m{asis{x}}} m{1} m{2} m{3}", lim).empty(), SL);
+				error = eval("defs{m{asis{x}}} m{1} m{2} m{3} m{4}", lim);
+				tst::check(error.find("macro expansion limit (3) exceeded") != std::string::npos, SL) << error;
+
+				lim = {};
+				lim.max_time = std::chrono::milliseconds(1);
+				std::string values;
+				for(unsigned i = 0; i != 2000; ++i){
+					values += "v ";
+				}
+				error = eval("for{i{" + values + "} for{j{" + values + "} b{z}}}", lim);
+				tst::check(error.find("time limit (1 ms) exceeded") != std::string::npos, SL) << error;
+
+				// limits apply to each evaluation separately
+				{
+					curlydoc::interpreter interpreter(nullptr);
+					lim = {};
+					lim.max_nodes = 5;
+					interpreter.set_limits(lim);
+					for(unsigned i = 0; i != 3; ++i){
+						interpreter.eval(tml::read_ext("a b c d e"));
+					}
+				}
+			}
+		);
 
-				auto res = interpreter.eval(in.begin(), in.end());
-				tst::check(
-						res == tml::read_ext(p.second),
-						[&](auto&o){o << "res = " << tml::to_non_ext(res);},
-						SL
-					);
+	suite.add(
+			"deep_nesting_does_not_recurse",
+			[](){
+				// deeper than the native stack would allow for recursive evaluation
+				constexpr size_t depth = 20000;
+
+				// build the document without the parser: m{b{m{b{... x}}}}
+				auto nested = [](const std::string& innermost){
+					tml::forest_ext doc;
+					doc.emplace_back(innermost);
+					for(size_t i = 0; i != depth; ++i){
+						tml::forest_ext level;
+						level.emplace_back(i % 2 == 0 ? "b" : "m");
+						level.back().children = std::move(doc);
+						doc = std::move(level);
+					}
+					return doc;
+				};
+
+				curlydoc::interpreter interpreter(nullptr);
+				interpreter.add_repeater_function("b");
+				interpreter.eval(tml::read_ext("defs{m{asis{b{${@}}}}}"), true);
+
+				auto out = interpreter.eval(nested("x"));
+
+				// every macro is expanded to the repeater
+				size_t num_levels = 0;
+				const tml::forest_ext* f = &out;
+				for(; f->size() == 1 && f->front().value.string == "b"; f = &f->front().children){
+					++num_levels;
+				}
+				tst::check_eq(num_levels, depth, SL);
+				tst::check_eq(f->size(), size_t(1), SL);
+				tst::check_eq(f->front().value.string, std::string("x"), SL);
+
+				// error location backtrace shows the innermost and the outermost calls
+				auto doc = nested("x");
+				tml::forest_ext* innermost = &doc;
+				while(!innermost->front().children.empty()){
+					innermost = &innermost->front().children;
+				}
+				innermost->front().value.string = "unknown_function";
+				innermost->front().children.emplace_back("arg");
+
+				try{
+					interpreter.eval(doc);
+					tst::check(false, SL);
+				}catch(curlydoc::interpreter::exception& e){
+					std::string error = e.what();
+					tst::check(error.find("function/macro 'unknown_function' not found") != std::string::npos, SL);
+					size_t num_locations = 0;
+					for(auto i = error.find('\n'); i != std::string::npos; i = error.find('\n', i + 1)){
+						++num_locations;
+					}
+					// the skipped calls take one line
+					tst::check_eq(num_locations, 2 * curlydoc::interpreter::exception::max_shown_calls + 1, SL) << error;
+					tst::check(error.find(": unknown_function\n") != std::string::npos, SL) << error;
+					tst::check(error.find(" more calls ...\n") != std::string::npos, SL) << error;
+				}
 			}
 		);
 });
@@ -0,0 +1,85 @@
+#include <tst/set.hpp>
+#include <tst/check.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+#include <papki/fs_file.hpp>
+
+#include "../../src/lib/curlydoc/include_cache.hpp"
+#include "../../src/lib/curlydoc/mapped_file.hpp"
+
+namespace{
+const tst::set set0("mapped_file", [](tst::suite& suite){
+	suite.add<std::string>(
+			"maps_whole_file",
+			{"", "a", std::string(0x12345, 'x')},
+			[](const auto& p){
+				const std::string file_name = "mapped_file_test.tmp";
+
+				std::ofstream(file_name, std::ios::binary) << p;
+
+				std::string contents;
+				{
+					curlydoc::mapped_file f(file_name);
+					contents = f.str();
+				}
+				std::remove(file_name.c_str());
+
+				tst::check(contents == p, SL) << "mapped size = " << contents.size() << ", expected size = " << p.size();
+			}
+		);
+
+	suite.add(
+			"unmapped_file_survives_truncation",
+			[](){
+				const std::string file_name = "unmapped_file_test.tmp";
+				const std::string data(0x12345, 'x');
+
+				std::ofstream(file_name, std::ios::binary) << data;
+
+				curlydoc::enable_file_mapping(false);
+				std::string contents;
+				{
+					curlydoc::mapped_file f(file_name);
+
+					// accessing a truncated mapped file would raise SIGBUS
+					std::ofstream(file_name, std::ios::binary | std::ios::trunc);
+
+					contents = f.str();
+				}
+				curlydoc::enable_file_mapping(true);
+				std::remove(file_name.c_str());
+
+				tst::check(contents == data, SL) << "read size = " << contents.size();
+			}
+		);
+
+	suite.add(
+			"missing_file_throws",
+			[](){
+				bool thrown = false;
+				try{
+					curlydoc::mapped_file f("non_existing_file.tmp");
+				}catch(std::system_error&){
+					thrown = true;
+				}
+				tst::check(thrown, SL);
+			}
+		);
+
+	suite.add(
+			"read_forest_parses_file",
+			[](){
+				const std::string file_name = "read_forest_test.tmp";
+
+				std::ofstream(file_name, std::ios::binary) << "a{b c} d";
+
+				auto forest = curlydoc::read_forest(papki::fs_file(file_name));
+				std::remove(file_name.c_str());
+
+				tst::check(forest == tml::read_ext("a{b c} d"), SL) << "forest = " << forest;
+			}
+		);
+});
+}
@@ -0,0 +1,53 @@
+#include <tst/set.hpp>
+#include <tst/check.hpp>
+
+#include "../../src/lib/curlydoc/memory_accounting.hpp"
+
+namespace{
+const tst::set set0("memory_accounting", [](tst::suite& suite){
+	suite.add(
+			"counts_by_phase",
+			[](){
+				using curlydoc::memory_accounting;
+
+				// unit tests do not replace operator new, so allocations are reported by hand
+				memory_accounting::reset();
+
+				{
+					memory_accounting::phase_scope parse_scope(memory_accounting::phase::parse);
+					memory_accounting::allocated(1000);
+
+					{
+						memory_accounting::phase_scope eval_scope(memory_accounting::phase::eval);
+						memory_accounting::allocated(500);
+						memory_accounting::freed(200);
+					}
+
+					memory_accounting::allocated(10);
+				}
+
+				memory_accounting::freed(1000);
+
+				const auto& stats = memory_accounting::get();
+
+				tst::check_eq(stats.current_bytes, ptrdiff_t(310), SL);
+				tst::check_eq(stats.peak_bytes, ptrdiff_t(1500), SL);
+
+				const auto& parse = stats.phases[size_t(memory_accounting::phase::parse)];
+				tst::check_eq(parse.num_allocations, size_t(2), SL);
+				tst::check_eq(parse.allocated_bytes, size_t(1010), SL);
+				tst::check_eq(parse.net_bytes, ptrdiff_t(1010), SL);
+				tst::check_eq(parse.peak_bytes, ptrdiff_t(1310), SL);
+
+				const auto& eval = stats.phases[size_t(memory_accounting::phase::eval)];
+				tst::check_eq(eval.num_allocations, size_t(1), SL);
+				tst::check_eq(eval.net_bytes, ptrdiff_t(300), SL);
+				tst::check_eq(eval.peak_bytes, ptrdiff_t(1500), SL);
+
+				const auto& other = stats.phases[size_t(memory_accounting::phase::other)];
+				tst::check_eq(other.num_allocations, size_t(0), SL);
+				tst::check_eq(other.net_bytes, ptrdiff_t(-1000), SL);
+			}
+		);
+});
+}
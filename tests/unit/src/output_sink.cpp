@@ -0,0 +1,51 @@
+#include <tst/set.hpp>
+#include <tst/check.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "../../src/lib/curlydoc/output_sink.hpp"
+
+namespace{
+const tst::set set0("output_sink", [](tst::suite& suite){
+	suite.add<size_t>(
+			"fd_sink_writes_all_data",
+			// sizes of written pieces of data
+			{1, 1000, 0x10000, 0x30000},
+			[](const auto& piece_size){
+				const std::string file_name = "fd_sink_test.tmp";
+
+				std::string expected;
+				{
+					curlydoc::fd_sink out(file_name);
+
+					// enough data to fill all the chunks a few times
+					for(size_t i = 0; expected.size() < 0x400000; ++i){
+						std::string piece(piece_size, char('a' + i % 26));
+						out << piece << '\n';
+						expected += piece;
+						expected += '\n';
+					}
+
+					out.flush();
+				}
+
+				std::stringstream ss;
+				ss << std::ifstream(file_name, std::ios::binary).rdbuf();
+				std::remove(file_name.c_str());
+
+				tst::check(ss.str() == expected, SL) << "written size = " << ss.str().size() << ", expected size = " << expected.size();
+			}
+		);
+
+	suite.add(
+			"memory_sink_collects_data",
+			[](){
+				curlydoc::memory_sink out;
+				out << "hello" << ' ' << std::string("world");
+				tst::check_eq(out.str(), std::string("hello world"), SL);
+			}
+		);
+});
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <tst/set.hpp>
 #include <tst/check.hpp>
 
@@ -26,15 +28,18 @@ const tst::set set("traslator_to_html", [](tst::suite& suite){
 				{"some ins{br}\nstuff", "some\n<br/>\nstuff"},
 				{"some\nins{br} stuff", "some\n<br/>\nstuff"},
 				{"some\nins{br}\nstuff", "some\n<br/>\nstuff"},
+				{"a<b && b>c", "a&lt;b &amp;&amp; b&gt;c"},
+				{"list{li{a} li{list{li{b}}}}", "\n<ul>\n<li>a</li>\n<li>\n<ul>\n<li>b</li>\n</ul></li>\n</ul>"},
 			},
 			[](const auto& p){
 				const auto in = tml::read_ext(p.first.c_str());
 
-				curlydoc::translator_to_html tr;
+				curlydoc::memory_sink out;
+				curlydoc::translator_to_html tr(out);
 
 				tr.translate(in);
 
-				auto str = tr.ss.str();
+				auto str = out.str();
 				tst::check(str == p.second, SL) << "str = " << str;
 			}
 		);
@@ -51,21 +56,88 @@ const tst::set set("traslator_to_html", [](tst::suite& suite){
 				{"pre b{bold} post", "pre <b>bold</b> post"},
 				{"mi\"b\"{dd}le", "mi<b>dd</b>le"},
 				{"mi\"i\"{dd}le", "mi<i>dd</i>le"},
-				{"some \"quoted\" stuff", "some quoted stuff"}
+				{"some \"quoted\" stuff", "some quoted stuff"},
+				{"defs{m{asis{i{${@}} and}}} some m{x} b{y} m{z}", "some <i>x</i> and <b>y</b> <i>z</i> and"}
 			},
 			[](const auto& p){
 				const auto in = tml::read_ext(p.first.c_str());
 
 				curlydoc::interpreter interpreter(nullptr);
 
-				curlydoc::translator_to_html tr;
+				curlydoc::memory_sink out;
+				curlydoc::translator_to_html tr(out);
 
 				interpreter.add_repeater_functions(tr.list_tags());
 
 				tr.translate(interpreter.eval(in));
 
-				auto str = tr.ss.str();
+				auto str = out.str();
 				tst::check(str == p.second, SL) << "str = " << str;
+
+				// streamed evaluation and translation
+				curlydoc::memory_sink streamed_out;
+				curlydoc::translator_to_html streamed_tr(streamed_out);
+
+				interpreter.eval(in.begin(), in.end(), [&](tml::tree_ext&& node){
+					streamed_tr.translate_next(node);
+				});
+
+				auto streamed_str = streamed_out.str();
+				tst::check(streamed_str == p.second, SL) << "streamed_str = " << streamed_str;
+			}
+		);
+
+	suite.add<std::string>(
+			"misplaced_tag_is_reported",
+			{
+				"list{li{a} b{li{b}}}",
+				"table{prm{cols{1}} cell{a} i{cell{b}}}",
+				"p{li{a}}",
+			},
+			[](const auto& p){
+				curlydoc::memory_sink out;
+				curlydoc::translator_to_html tr(out);
+
+				std::string error;
+				try{
+					tr.translate(tml::read_ext(p));
+				}catch(std::invalid_argument& e){
+					error = e.what();
+				}
+				tst::check(error.find("only allowed directly inside") != std::string::npos, SL) << "error = " << error;
+			}
+		);
+
+	suite.add(
+			"added_tag_is_translated",
+			[](){
+				curlydoc::memory_sink out;
+				curlydoc::translator_to_html tr(out);
+
+				tr.add_tag("em", [&tr, &out](bool space, const tml::forest_ext& forest){
+					if(space){
+						tr.on_word(" ");
+					}
+					out << "<em>";
+					tr.translate(forest);
+					out << "</em>";
+				});
+
+				auto tags = tr.list_tags();
+				tst::check(std::find(tags.begin(), tags.end(), "em") != tags.end(), SL);
+				tst::check(std::find(tags.begin(), tags.end(), "b") != tags.end(), SL);
+
+				tr.translate(tml::read_ext("some em{emphasized b{bold}} text"));
+
+				tst::check_eq(out.str(), std::string("some <em>emphasized <b>bold</b></em> text"), SL);
+
+				bool thrown = false;
+				try{
+					tr.add_tag("b", [](bool, const tml::forest_ext&){});
+				}catch(std::logic_error&){
+					thrown = true;
+				}
+				tst::check(thrown, SL);
 			}
 		);
 });